@@ -12,6 +12,7 @@
 #include "game.h"
 #include "timer0.h"
 #include "buttons.h"
+#include "trace.h"
 
 #include "serialio.h"
 #include <stdio.h>
@@ -45,25 +46,23 @@ uint16_t map(uint16_t x, uint16_t in_min, uint16_t in_max, uint16_t out_min, uin
 	return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
 }
 
-static uint32_t cur_time = 0, next_read_time = 0, next_queue_time = 0;
+static uint32_t cur_time = 0, next_queue_time = 0;
 static uint16_t last_mapped = 0;
 static uint8_t holding = 0;
-//
+
+void adc_think(void){
+	ADCSRA |= (1<<ADSC);
+}
+
 int8_t adc_move(void){
-	// Ensure we're always trying to read the adc value
-	cur_time = get_current_time();
-	if(cur_time >= next_read_time){
-		ADCSRA |= (1<<ADSC);
-		// Try read every 50 ms
-		next_read_time = cur_time + 50;
-	}
-	
 	int8_t return_value = NO_MOVEMENT;
 	
 	if(adc_queue_length > 0 ){
+		// We only need the time when there is a reading to act on
+		cur_time = get_current_time();
 		uint16_t val = adc_queue[0];
 		uint16_t mapped = map(val, 0, 1024, 0, 3) - 1;
-		/*printf("X: %4d, Mapped: %4d \n", val, mapped);*/
+		TRACE2(TRACE_ADC, val, mapped);
 		if(mapped != last_mapped){
 			holding = 0;
 			next_queue_time = 0;
@@ -11,8 +11,14 @@
 
 #include <stdint.h>
 
+// Time between ADC readings (ms)
+#define ADC_READ_PERIOD_MS	(50)
+
 void init_adc_interrupts(void);
 
+// Start a reading. This should be called every ADC_READ_PERIOD_MS.
+void adc_think(void);
+
 int8_t adc_move(void);
 
 #endif /* ADC_H_ */
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+ * animation.c
+ *
+ * Plays pre-rendered animations stored in program memory on the LED matrix.
+ */
+
+#include "animation.h"
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "ledmatrix.h"
+#include "timer0.h"
+
+static const struct animation* current_animation;
+static const uint8_t* next_frame_data;	// Data for the next frame to show
+static const uint8_t* loop_frame_data;	// Data for the loop frame
+static uint8_t next_frame;
+static uint32_t next_frame_time;
+
+static const uint8_t* show_frame(const uint8_t* frame_data);
+
+void animation_start(const struct animation* anim) {
+	current_animation = anim;
+	loop_frame_data = anim->frames;
+	next_frame_data = show_frame(anim->frames);
+	next_frame = 1;
+	if (next_frame == anim->loop_frame) {
+		loop_frame_data = next_frame_data;
+	}
+	next_frame_time = get_current_time() + anim->frame_time;
+}
+
+void animation_stop(void) {
+	current_animation = 0;
+}
+
+uint8_t animation_is_playing(void) {
+	return current_animation != 0;
+}
+
+void animation_think(void) {
+	if (!current_animation) {
+		return;
+	}
+	uint32_t current_time = get_current_time();
+	if (current_time < next_frame_time) {
+		return;
+	}
+	
+	if (next_frame >= current_animation->num_frames) {
+		// Start again from the loop frame
+		next_frame = current_animation->loop_frame;
+		next_frame_data = loop_frame_data;
+	}
+	next_frame_data = show_frame(next_frame_data);
+	next_frame++;
+	
+	// Remember where the loop frame starts the first time we pass it
+	if (next_frame == current_animation->loop_frame) {
+		loop_frame_data = next_frame_data;
+	}
+	next_frame_time = current_time + current_animation->frame_time;
+}
+
+// Write the columns of one frame to the display and return a pointer to the
+// data for the following frame
+static const uint8_t* show_frame(const uint8_t* frame_data) {
+	MatrixColumn column;
+	uint8_t num_columns = pgm_read_byte(frame_data++);
+	
+	for (uint8_t i = 0; i < num_columns; i++) {
+		uint8_t x = pgm_read_byte(frame_data++);
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+			column[y] = pgm_read_byte(frame_data++);
+		}
+		ledmatrix_set_column(x, column);
+	}
+	ledmatrix_flush();
+	return frame_data;
+}
@@ -0,0 +1,41 @@
+/*
+ * animation.h
+ *
+ * Plays pre-rendered animations stored in program memory on the LED matrix.
+ * Each frame only lists the columns that differ from the frame before it,
+ * so only those columns are written to the display.
+ *
+ * Frame data is a sequence of frames. Each frame is a byte giving the number
+ * of columns in the frame, followed by that many columns. Each column is its
+ * x position followed by MATRIX_NUM_ROWS pixel colours (bottom row first).
+ * The first frame (the key frame) should set every column the animation
+ * uses. After the last frame the animation continues from loop_frame, so
+ * that frame must list every column that differs from both the last frame
+ * and the frame before loop_frame.
+ */
+
+#ifndef ANIMATION_H_
+#define ANIMATION_H_
+
+#include <stdint.h>
+
+struct animation {
+	const uint8_t* frames;	// Frame data (in program memory)
+	uint8_t num_frames;		// Number of frames, including the key frame
+	uint8_t loop_frame;		// Frame to go back to after the last frame
+	uint16_t frame_time;	// Time between frames (ms)
+};
+
+// Show the key frame of the given animation and start playing it.
+void animation_start(const struct animation* anim);
+
+void animation_stop(void);
+
+// Returns 1 if an animation is playing, 0 otherwise
+uint8_t animation_is_playing(void);
+
+// Show the next frame of the animation if it is due. This should be called
+// frequently from the main loop.
+void animation_think(void);
+
+#endif /* ANIMATION_H_ */
@@ -0,0 +1,137 @@
+/*
+ * calibrate.c
+ *
+ * Finds the fastest SPI link settings that the LED matrix copes with.
+ */
+
+#include "calibrate.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <avr/pgmspace.h>
+#include "ledmatrix.h"
+#include "spi.h"
+#include "serialio.h"
+#include "terminalio.h"
+#include "timer0.h"
+
+// Settings to try, from slowest to fastest. The panel needs time to store
+// each command, so at each clock speed we start with a long gap between
+// commands (in fine ticks of 8us) and shorten it.
+static const uint8_t clock_dividers[] PROGMEM = { 64, 32, 16, 8 };
+static const uint8_t command_gaps[] PROGMEM = { 48, 12, 0 };
+
+#define NUM_CLOCK_DIVIDERS	(sizeof(clock_dividers) / sizeof(clock_dividers[0]))
+#define NUM_COMMAND_GAPS	(sizeof(command_gaps) / sizeof(command_gaps[0]))
+
+// Times the pattern is drawn for each setting
+#define TEST_REPEATS 3
+
+static void draw_test_pattern(void);
+static uint8_t ask_operator(const struct ledmatrix_link* link);
+static uint32_t frame_time(void);
+
+void calibrate_matrix_link(void) {
+	struct ledmatrix_link best = {
+		.clock_divider = LEDMATRIX_DEFAULT_CLOCK_DIVIDER,
+		.command_gap = 0
+	};
+	
+	ledmatrix_set_link(&best);
+	uint32_t default_time = frame_time();
+	
+	for (uint8_t i = 0; i < NUM_CLOCK_DIVIDERS; i++) {
+		uint8_t accepted = 0;
+		for (uint8_t j = 0; j < NUM_COMMAND_GAPS; j++) {
+			struct ledmatrix_link link = {
+				.clock_divider = pgm_read_byte(&clock_dividers[i]),
+				.command_gap = pgm_read_byte(&command_gaps[j])
+			};
+			ledmatrix_set_link(&link);
+			draw_test_pattern();
+			if (!ask_operator(&link)) {
+				break;
+			}
+			best = link;
+			accepted = 1;
+		}
+		if (!accepted) {
+			// Even the longest gap didn't help - this speed is too fast
+			break;
+		}
+	}
+	
+	ledmatrix_set_link(&best);
+	ledmatrix_save_link();
+	uint32_t best_time = frame_time();
+	ledmatrix_clear();
+	
+	move_terminal_cursor(10,16);
+	clear_to_end_of_line();
+	printf_P(PSTR("Saved divider %u, gap %u us. Full frame %lu us (was %lu us)"),
+			best.clock_divider, best.command_gap * US_PER_FINE_TICK,
+			best_time, default_time);
+}
+
+// Draw a red background, then overwrite it with a green and orange
+// checkerboard using row and pixel commands. If the panel drops a byte it
+// loses track of where the commands start, so the checkerboard is broken.
+static void draw_test_pattern(void) {
+	MatrixData background;
+	MatrixRow row;
+	
+	for (uint8_t repeat = 0; repeat < TEST_REPEATS; repeat++) {
+		ledmatrix_clear();
+		for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+			set_matrix_column_to_colour(background[x], COLOUR_RED);
+		}
+		ledmatrix_update_all(background);
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+			for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				row[x] = ((x + y) & 1) ? COLOUR_GREEN : COLOUR_RED;
+			}
+			ledmatrix_update_row(y, row);
+		}
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+			for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				if (!((x + y) & 1)) {
+					ledmatrix_update_pixel(x, y, COLOUR_ORANGE);
+				}
+			}
+		}
+	}
+	spi_flush();
+}
+
+// Returns 1 if the operator says the test pattern is right, 0 otherwise
+static uint8_t ask_operator(const struct ledmatrix_link* link) {
+	move_terminal_cursor(10,14);
+	clear_to_end_of_line();
+	printf_P(PSTR("Divider %u, gap %u us: is the display an even green and "
+			"orange checkerboard? (y/n)"), link->clock_divider,
+			link->command_gap * US_PER_FINE_TICK);
+	while (1) {
+		if (serial_input_available()) {
+			char input = (char)tolower(fgetc(stdin));
+			if (input == 'y') {
+				return 1;
+			} else if (input == 'n') {
+				return 0;
+			}
+		}
+	}
+}
+
+// Return the time taken to send a whole frame (in microseconds)
+static uint32_t frame_time(void) {
+	MatrixData data;
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		set_matrix_column_to_colour(data[x], COLOUR_BLACK);
+	}
+	spi_flush();
+	uint16_t start = get_fine_time();
+	ledmatrix_update_all(data);
+	spi_flush();
+	return (uint32_t)(uint16_t)(get_fine_time() - start)
+			* US_PER_FINE_TICK;
+}
@@ -0,0 +1,19 @@
+/*
+ * calibrate.h
+ *
+ * Finds the fastest SPI link settings that the LED matrix copes with. The
+ * panel can't report errors, so each setting is checked by drawing a test
+ * pattern and asking the operator (over the serial terminal) whether it
+ * came out right.
+ */
+
+#ifndef CALIBRATE_H_
+#define CALIBRATE_H_
+
+// Try progressively faster clock dividers, each with progressively shorter
+// gaps between commands, until the operator rejects one. The fastest
+// setting that was accepted is used and saved in EEPROM. Waits for serial
+// input, so this should only be used from the start screen.
+void calibrate_matrix_link(void);
+
+#endif /* CALIBRATE_H_ */
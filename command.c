@@ -0,0 +1,229 @@
+/*
+ * command.c
+ *
+ * Line based commands on the serial port.
+ */
+
+#include "command.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "game.h"
+#include "cpu.h"
+#include "serialio.h"
+#include "terminalio.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "timer0.h"
+
+// Limits for the speed command (ms)
+#define MIN_BALL_PERIOD		(50)
+#define MAX_BALL_PERIOD		(2000)
+
+static char line[COMMAND_MAX_LENGTH + 1];
+static uint8_t line_length;
+static uint8_t in_command;
+static uint8_t too_long;
+static uint8_t game_active;
+
+void command_set_game_active(uint8_t active) {
+	game_active = active;
+}
+
+// Start a reply on its own line. Replies were asked for, so we wait for
+// them to be sent whatever the output policy.
+static uint8_t start_reply(void) {
+	uint8_t policy = serial_set_output_policy(SERIAL_BLOCK);
+	move_terminal_cursor(1, COMMAND_REPLY_ROW);
+	clear_to_end_of_line();
+	return policy;
+}
+
+static void end_reply(uint8_t policy) {
+	printf_P(PSTR("\n"));
+	serial_set_output_policy(policy);
+}
+
+static void reply_error(PGM_P reason) {
+	uint8_t policy = start_reply();
+	printf_P(PSTR("err %S"), reason);
+	end_reply(policy);
+}
+
+// Read a whole word as a number. Returns 0 if it isn't one.
+static uint8_t parse_number(const char* word, int32_t* value) {
+	char* end;
+	if (!word) {
+		return 0;
+	}
+	*value = strtol(word, &end, 10);
+	return *word && !*end;
+}
+
+static void command_speed(char* argument) {
+	int32_t period;
+	if (!parse_number(argument, &period) || period < MIN_BALL_PERIOD ||
+			period > MAX_BALL_PERIOD) {
+		reply_error(PSTR("speed needs 50 to 2000 (ms)"));
+		return;
+	}
+	set_ball_period(period);
+	display_game_speed();
+	uint8_t policy = start_reply();
+	printf_P(PSTR("ok speed period=%u"), (uint16_t)period);
+	end_reply(policy);
+}
+
+static void command_move(char* player_word, char* direction_word) {
+	int32_t player;
+	int32_t direction;
+	if (!parse_number(player_word, &player) || player < 1 || player > 2 ||
+			!parse_number(direction_word, &direction) ||
+			(direction != UP && direction != DOWN)) {
+		reply_error(PSTR("move needs player 1 or 2 and +1 or -1"));
+		return;
+	}
+	if (!game_active || is_game_paused()) {
+		reply_error(PSTR("move while not playing"));
+		return;
+	}
+	move_player_paddle(player - 1, direction);
+	uint8_t policy = start_reply();
+	printf_P(PSTR("ok move player=%d y=%d"), (int8_t)player,
+			get_player_y(player - 1));
+	end_reply(policy);
+}
+
+static void command_cpu(char* argument) {
+	uint8_t on;
+	if (argument && !strcmp_P(argument, PSTR("on"))) {
+		on = 1;
+	} else if (argument && !strcmp_P(argument, PSTR("off"))) {
+		on = 0;
+	} else {
+		reply_error(PSTR("cpu needs on or off"));
+		return;
+	}
+	if (on != is_cpu_enabled()) {
+		toggle_cpu_enabled();
+	}
+	uint8_t policy = start_reply();
+	printf_P(PSTR("ok cpu enabled=%u"), on);
+	end_reply(policy);
+}
+
+static void command_baud(char* argument) {
+	int32_t rate;
+	uint8_t double_speed;
+	if (!parse_number(argument, &rate) || rate <= 0 ||
+			abs(serial_baud_error(rate, &double_speed)) >
+			SERIAL_MAX_BAUD_ERROR) {
+		reply_error(PSTR("baud rate not available"));
+		return;
+	}
+	// Reply at the old rate, then switch
+	uint8_t policy = start_reply();
+	printf_P(PSTR("ok baud rate=%ld"), rate);
+	end_reply(policy);
+	TRACE1(TRACE_BAUD, rate / 100);
+	serial_set_baud(rate);
+}
+
+static void command_stats(void) {
+	struct serial_output_stats serial;
+	struct telemetry_stats telemetry;
+	struct trace_stats trace;
+	serial_get_output_stats(&serial);
+	telemetry_get_stats(&telemetry);
+	trace_get_stats(&trace);
+	uint8_t policy = start_reply();
+	struct serial_lane_stats* hud = &serial.lanes[SERIAL_LANE_HUD];
+	struct serial_lane_stats* bulk = &serial.lanes[SERIAL_LANE_BULK];
+	printf_P(PSTR("ok stats hud_used=%u hud_max=%u hud_dropped=%u "
+			"bulk_used=%u bulk_max=%u bulk_dropped_writes=%u "
+			"bulk_dropped_chars=%u coalesced=%u telemetry_sent=%u "
+			"telemetry_dropped=%u trace_sent=%u trace_dropped=%u"),
+			hud->used, hud->max_used, hud->dropped_writes, bulk->used,
+			bulk->max_used, bulk->dropped_writes, bulk->dropped_chars,
+			serial.coalesced, telemetry.frames_sent,
+			telemetry.frames_dropped, trace.sent, trace.dropped);
+	end_reply(policy);
+}
+
+static void command_state(void) {
+	struct ball_data ball;
+	get_ball_data(&ball);
+	uint8_t policy = start_reply();
+	printf_P(PSTR("ok state time=%lu ball=%d,%d direction=%d,%d "
+			"paddles=%d,%d score=%d,%d rally=%d,%d period=%lu paused=%u "
+			"cpu=%u active=%u"), get_current_time(), ball.ball_x,
+			ball.ball_y, ball.ball_x_direction, ball.ball_y_direction,
+			get_player_y(PLAYER_1), get_player_y(PLAYER_2),
+			get_player_score(PLAYER_1), get_player_score(PLAYER_2),
+			get_player_rally(PLAYER_1), get_player_rally(PLAYER_2),
+			get_game_speed(), is_game_paused(), is_cpu_enabled(),
+			game_active);
+	end_reply(policy);
+}
+
+// Split the line into words and carry out the command
+static void run_command(void) {
+	char* name = strtok(line, " ");
+	char* argument = strtok(NULL, " ");
+	char* argument_2 = strtok(NULL, " ");
+	if (!name) {
+		reply_error(PSTR("empty command"));
+	} else if (!strcmp_P(name, PSTR("speed"))) {
+		command_speed(argument);
+	} else if (!strcmp_P(name, PSTR("move"))) {
+		command_move(argument, argument_2);
+	} else if (!strcmp_P(name, PSTR("cpu"))) {
+		command_cpu(argument);
+	} else if (!strcmp_P(name, PSTR("baud"))) {
+		command_baud(argument);
+	} else if (!strcmp_P(name, PSTR("stats"))) {
+		command_stats();
+	} else if (!strcmp_P(name, PSTR("state?"))) {
+		command_state();
+	} else {
+		reply_error(PSTR("unknown command"));
+	}
+}
+
+char command_think(void) {
+	while (serial_input_available()) {
+		char c = fgetc(stdin);
+		if (!in_command) {
+			if (c != COMMAND_PREFIX) {
+				return c;
+			}
+			in_command = 1;
+			line_length = 0;
+			too_long = 0;
+		} else if (c == '\n') {
+			in_command = 0;
+			line[line_length] = 0;
+			if (too_long) {
+				reply_error(PSTR("command too long"));
+			} else {
+				run_command();
+			}
+		} else if (c == '\b' || c == 0x7F) {
+			if (line_length) {
+				line_length--;
+			}
+		} else if (line_length < COMMAND_MAX_LENGTH) {
+			line[line_length++] = c;
+		} else {
+			too_long = 1;
+		}
+	}
+	return -1;
+}
+
+void command_clear_input(void) {
+	clear_serial_input_buffer();
+	in_command = 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * command.h
+ *
+ * Line based commands on the serial port, so that the game can be driven
+ * by a program as well as from the keyboard. A command is a ':' followed
+ * by words separated by spaces and ended by a new line, e.g.
+ *
+ *   :speed 250        time between ball moves (ms)
+ *   :move 1 +1        move player 1's paddle up (-1 for down)
+ *   :cpu on           computer player on or off
+ *   :baud 76800       change the baud rate (see serial_set_baud())
+ *   :stats            serial, telemetry and trace counters
+ *   :state?           time, ball, paddles, scores and rally counts
+ *
+ * Every command gets a one line reply on row COMMAND_REPLY_ROW starting
+ * with "ok" and the command, followed by any values as name=value, or
+ * with "err" and the reason. Keys typed outside a command work as before.
+ */
+
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdint.h>
+
+#define COMMAND_PREFIX		(':')
+#define COMMAND_MAX_LENGTH	(32)
+#define COMMAND_REPLY_ROW	(36)
+
+// Read all the serial input waiting, carrying out any commands completed.
+// Stops at the first key typed outside a command and returns it, so keys
+// are still handled one at a time. Returns -1 if there is no such key.
+char command_think(void);
+
+// Throw away the serial input waiting and any command part way through
+// being typed. Use this rather than clear_serial_input_buffer(), so that
+// the keys typed next aren't taken as the rest of the command.
+void command_clear_input(void);
+
+// Commands that only make sense during a game are refused unless active
+// is set
+void command_set_game_active(uint8_t active);
+
+#endif /* COMMAND_H_ */
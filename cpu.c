@@ -7,7 +7,7 @@
 
 #include "cpu.h"
 #include "game.h"
-#include "timer0.h"
+#include "sched.h"
 
 #include <limits.h>
 #include <stdint.h>
@@ -21,7 +21,7 @@
 
 // 0 when human controlled, 1 for cpu player
 static uint8_t cpu_enabled = 0;
-static uint32_t next_move_time = 0, next_guide_move = 0, current_time = 0, last_predict_time;
+static uint32_t current_time = 0, last_predict_time;
 static struct ball_data last_ball_data;
 static struct prediction last_p;
 
@@ -35,13 +35,11 @@ uint8_t is_cpu_enabled(void){
 
 void toggle_cpu_enabled(void){
 	cpu_enabled ^= 1;
-	if(cpu_enabled){
-		next_move_time = current_time + 100;
-	}
 }
 
+// Run by the scheduler every CPU_MOVE_DELAY ms
 void cpu_think(void){
-	current_time = get_current_time();
+	current_time = sched_now();
 	cpu_y_coordinate = get_player_y(CPU_PLAYER);
 	if(!is_cpu_enabled()) return;
 	
@@ -49,23 +47,20 @@ void cpu_think(void){
 	p.player_x = get_player_x(CPU_PLAYER);
 	predict_ball(&p);
 	
-	if(current_time >= next_move_time){
-		if(p.y >= 0){
-			if(p.y < cpu_y_coordinate){
-				// move Down
-				move_player_paddle(CPU_PLAYER, DOWN);
-			}else if (p.y > cpu_y_coordinate){
-				// move UP
-				move_player_paddle(CPU_PLAYER, UP);
-			}
+	if(p.y >= 0){
+		if(p.y < cpu_y_coordinate){
+			// move Down
+			move_player_paddle(CPU_PLAYER, DOWN);
+		}else if (p.y > cpu_y_coordinate){
+			// move UP
+			move_player_paddle(CPU_PLAYER, UP);
 		}
-		
-		next_move_time = current_time + 200;
 	}
 }
 
+// Run by the scheduler every CPU_MOVE_DELAY ms
 void guide_think(void){
-	current_time = get_current_time();
+	current_time = sched_now();
 	if(!is_cpu_enabled()) return;
 	int8_t guide_y_coordinate = get_guide_y();
 
@@ -73,17 +68,14 @@ void guide_think(void){
 	p.player_x = get_player_x(PLAYER_2);
 	predict_ball(&p);
 	
-	if(current_time >= next_guide_move){
-		if(p.y >= 0){
-			if(p.y < guide_y_coordinate){
-				// move Down
-				update_guide_paddle(guide_y_coordinate + DOWN);
-			}else if (p.y > guide_y_coordinate){
-			// move UP
-				update_guide_paddle(guide_y_coordinate + UP);
-			}
+	if(p.y >= 0){
+		if(p.y < guide_y_coordinate){
+			// move Down
+			update_guide_paddle(guide_y_coordinate + DOWN);
+		}else if (p.y > guide_y_coordinate){
+		// move UP
+			update_guide_paddle(guide_y_coordinate + UP);
 		}
-		next_guide_move = current_time + 200;
 	}
 }
 
@@ -16,8 +16,9 @@ struct prediction {
 	int8_t player_x;
 };
 
-// How many ms between each cpu move
-#define CPU_MOVE_DELAY		100
+// How many ms between each cpu (and guide) move. cpu_think() and
+// guide_think() should be called this often.
+#define CPU_MOVE_DELAY		200
 #define CPU_PLAYER		PLAYER_1
 
 uint8_t is_cpu_enabled(void);
@@ -7,203 +7,335 @@
 
 #include "display.h"
 #include <stdio.h>
+#include <avr/pgmspace.h>
 #include "pixel_colour.h"
 #include "ledmatrix.h"
 #include "game.h"
+#include "animation.h"
 
-// constant value used to display 'PONG' on launch
-static const uint8_t pong_display[MATRIX_NUM_COLUMNS] = 
-		{126, 72, 120, 127, 67, 127, 126, 64, 126, 127, 67, 79, 0, 2, 82, 64};
+// Start screen animation. The key frame shows 'PONG' with a ball next to
+// it, then the following frames animate two paddles hitting the ball back
+// and forth in the three right hand columns. See animation.h for the format.
+// (0xF0 is green and 0x0F is red.)
+static const uint8_t start_screen_frames[] PROGMEM = {
+	// Key frame
+	16,
+	0, 0x00, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0x00,
+	1, 0x00, 0x00, 0x00, 0xF0, 0x00, 0x00, 0xF0, 0x00,
+	2, 0x00, 0x00, 0x00, 0xF0, 0xF0, 0xF0, 0xF0, 0x00,
+	3, 0x00, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x00,
+	4, 0x00, 0x0F, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x00,
+	5, 0x00, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x00,
+	6, 0x00, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0x00,
+	7, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF0, 0x00,
+	8, 0x00, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0x00,
+	9, 0x00, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x00,
+	10, 0x00, 0x0F, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x00,
+	11, 0x00, 0x0F, 0x0F, 0x0F, 0x00, 0x00, 0x0F, 0x00,
+	12, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	13, 0x00, 0xF0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	14, 0x00, 0xF0, 0x00, 0x00, 0x0F, 0x00, 0xF0, 0x00,
+	15, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF0, 0x00,
+	// Frame 1
+	3,
+	13, 0x00, 0xF0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	14, 0x00, 0xF0, 0x00, 0x00, 0x0F, 0x00, 0xF0, 0x00,
+	15, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF0, 0x00,
+	// Frame 2
+	1,
+	14, 0x00, 0xF0, 0x00, 0x0F, 0x00, 0x00, 0xF0, 0x00,
+	// Frame 3
+	1,
+	14, 0x00, 0xF0, 0x0F, 0x00, 0x00, 0x00, 0xF0, 0x00,
+	// Frame 4
+	3,
+	13, 0x00, 0xF0, 0x00, 0x00, 0x00, 0x00, 0xF0, 0x00,
+	14, 0x00, 0xF0, 0x00, 0x0F, 0x00, 0x00, 0xF0, 0x00,
+	15, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	// Frame 5
+	1,
+	14, 0x00, 0xF0, 0x00, 0x00, 0x0F, 0x00, 0xF0, 0x00,
+	// Frame 6
+	1,
+	14, 0x00, 0xF0, 0x00, 0x00, 0x00, 0x0F, 0xF0, 0x00,
+	// Frame 7
+	3,
+	13, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF0, 0x00,
+	14, 0x00, 0xF0, 0x00, 0x00, 0x0F, 0x00, 0xF0, 0x00,
+	15, 0x00, 0xF0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	// Frame 8
+	1,
+	14, 0x00, 0xF0, 0x00, 0x0F, 0x00, 0x00, 0xF0, 0x00,
+	// Frame 9
+	1,
+	14, 0x00, 0xF0, 0x0F, 0x00, 0x00, 0x00, 0xF0, 0x00,
+	// Frame 10
+	3,
+	13, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	14, 0x00, 0xF0, 0x00, 0x0F, 0x00, 0x00, 0xF0, 0x00,
+	15, 0x00, 0xF0, 0x00, 0x00, 0x00, 0x00, 0xF0, 0x00,
+	// Frame 11
+	1,
+	14, 0x00, 0xF0, 0x00, 0x00, 0x0F, 0x00, 0xF0, 0x00,
+	// Frame 12
+	1,
+	14, 0x00, 0xF0, 0x00, 0x00, 0x00, 0x0F, 0xF0, 0x00
+};
+
+static const struct animation start_screen_animation = {
+	.frames = start_screen_frames,
+	.num_frames = 13,
+	.loop_frame = 1,
+	.frame_time = 500
+};
 
 // Fonts for LED Matrix score display
-// Stored as a 5 x 3 grid pattern going from Left-to-Right, Top-to-Bottom
-// Padded with a leading zero so that it fits into a 16-bit value
-static const uint16_t LED_DIGIT_FONTS[10] = {
-    0b0111101101101111, // 0
-    0b0010010010010010, // 1
-    0b0111100111001111, // 2
-    0b0111001111001111, // 3
-    0b0001001111101101, // 4
-    0b0111001111100111, // 5
-    0b0111101111100111, // 6
-    0b0001001001001111, // 7
-    0b0111101111101111, // 8
-    0b0111001111101111, // 9
+// Each digit is 3 columns wide and 5 rows high, stored as one byte per
+// column from left to right. Bit 4 of each column is the top row and bit 0
+// is the bottom row.
+static const uint8_t LED_DIGIT_COLUMNS[10][FONT_WIDTH] PROGMEM = {
+	{0b11111, 0b10001, 0b11111}, // 0
+	{0b00000, 0b11111, 0b00000}, // 1
+	{0b10111, 0b10101, 0b11101}, // 2
+	{0b10101, 0b10101, 0b11111}, // 3
+	{0b11100, 0b00100, 0b11111}, // 4
+	{0b11101, 0b10101, 0b10111}, // 5
+	{0b11111, 0b10101, 0b10111}, // 6
+	{0b10000, 0b10000, 0b11111}, // 7
+	{0b11111, 0b10101, 0b11111}, // 8
+	{0b11101, 0b10101, 0b11111}, // 9
+};
+
+// Letters for scrolling text, in the same format as the digits
+static const uint8_t LED_LETTER_COLUMNS[26][FONT_WIDTH] PROGMEM = {
+	{0b01111, 0b10100, 0b01111}, // A
+	{0b11111, 0b10101, 0b01010}, // B
+	{0b01110, 0b10001, 0b10001}, // C
+	{0b11111, 0b10001, 0b01110}, // D
+	{0b11111, 0b10101, 0b10001}, // E
+	{0b11111, 0b10100, 0b10000}, // F
+	{0b01110, 0b10001, 0b10111}, // G
+	{0b11111, 0b00100, 0b11111}, // H
+	{0b10001, 0b11111, 0b10001}, // I
+	{0b00010, 0b00001, 0b11110}, // J
+	{0b11111, 0b00100, 0b11011}, // K
+	{0b11111, 0b00001, 0b00001}, // L
+	{0b11111, 0b01100, 0b11111}, // M
+	{0b11111, 0b10000, 0b01111}, // N
+	{0b01110, 0b10001, 0b01110}, // O
+	{0b11111, 0b10100, 0b01000}, // P
+	{0b01110, 0b10011, 0b01101}, // Q
+	{0b11111, 0b10100, 0b01011}, // R
+	{0b01001, 0b10101, 0b10010}, // S
+	{0b10000, 0b11111, 0b10000}, // T
+	{0b11111, 0b00001, 0b11111}, // U
+	{0b11110, 0b00001, 0b11110}, // V
+	{0b11111, 0b00110, 0b11111}, // W
+	{0b11011, 0b00100, 0b11011}, // X
+	{0b11000, 0b00111, 0b11000}, // Y
+	{0b10011, 0b10101, 0b11001}, // Z
+};
+
+// Layers of the game display. Each pixel of the LED matrix has a byte
+// saying which layers are present there:
+// - bit 0 is set for border pixels (otherwise the background is empty)
+// - bits 1 to 4 are set for each game object present (bit n for object n,
+//   see game.h)
+// - bits 5 and 6 hold the HUD colour drawn over everything else (if any)
+// The visible colour of a pixel is the colour of its top layer.
+#define BORDER_LAYER			(0x01)
+#define OBJECT_LAYER(object)	(1 << (object))
+#define HUD_LAYER_MASK			(0x60)
+#define HUD_SCORE				(0x20)
+#define HUD_RALLY				(0x40)
+
+static uint8_t layers[MATRIX_NUM_COLUMNS][MATRIX_NUM_ROWS];
+
+// Bit y of changed_layers[x] is set if the layers at (x, y) have changed
+// since the last call to display_compose()
+static uint8_t changed_layers[MATRIX_NUM_COLUMNS];
+
+// Game objects in the order they are drawn over each other (top first),
+// and the colour of each object
+static const uint8_t OBJECT_ORDER[] = {BALL, PLAYER, OBSTACLE, GUIDE};
+static const PixelColour OBJECT_COLOURS[] = {
+	[EMPTY_SQUARE] = MATRIX_COLOUR_EMPTY,
+	[PLAYER] = MATRIX_COLOUR_PLAYER,
+	[BALL] = MATRIX_COLOUR_BALL,
+	[OBSTACLE] = MATRIX_COLOUR_OBSTACLE,
+	[GUIDE] = MATRIX_COLOR_GUIDE
 };
 
+static void set_layers(uint8_t x, uint8_t y, uint8_t clear_mask, uint8_t set_mask);
+static PixelColour layer_colour(uint8_t pixel_layers);
+
 // Initialise the display for the board, this creates the display
 // for an empty board.
 void initialise_display(void) {
-	// start by clearing the LED matrix
+	// start by clearing the LED matrix and all layers
 	ledmatrix_clear();
-
-	// create an array with the background colour at every position
-	PixelColour col_colours[MATRIX_NUM_ROWS];
-	for (int row = 0; row < MATRIX_NUM_ROWS; row++) {
-		col_colours[row] = MATRIX_COLOUR_BORDER;
-	}
-
-	// then add the bounds on the left
-	for (int x = 1; x < 1 + GAME_BORDER_WIDTH; x++) {
-		ledmatrix_update_column(x, col_colours);
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+			layers[x][y] = 0;
+		}
+		changed_layers[x] = 0;
 	}
 
-	// and add the bounds on the right
-	for (int x = 14; x < 14 + GAME_BORDER_WIDTH; x++) {
-		ledmatrix_update_column(x, col_colours);
+	// then add the bounds on the left and right
+	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+		for (uint8_t x = 1; x < 1 + GAME_BORDER_WIDTH; x++) {
+			set_layers(x, y, 0, BORDER_LAYER);
+		}
+		for (uint8_t x = MATRIX_X_OFFSET + BOARD_WIDTH;
+				x < MATRIX_X_OFFSET + BOARD_WIDTH + GAME_BORDER_WIDTH; x++) {
+			set_layers(x, y, 0, BORDER_LAYER);
+		}
 	}
 }
 
+// Shows the start screen and starts its animation. animation_think() must
+// be called regularly to animate it.
 void show_start_screen(void) {
-	PixelColour colour;
-	MatrixColumn column_colour_data;
-	uint8_t col_data;
-		
 	ledmatrix_clear(); // start by clearing the LED matrix
-	for (uint8_t col = 0; col < MATRIX_NUM_COLUMNS; col++) {
-		col_data = pong_display[col];
-		// using the LSB as the colour determining bit, 1 is red, 0 is green
-		if (col_data & 0x01) {
-			colour = COLOUR_RED;
-		} else {
-			colour = COLOUR_GREEN;
-		}
-		// go through the top 7 bits (not the bottom one as that was our colour bit)
-		// and set any to be the correct colour
-		for(uint8_t i = 7; i >= 1; i--) {
-			// If the relevant font bit is set, we make this a coloured pixel, else blank
-			if(col_data & 0x80) {
-				column_colour_data[i] = colour;
-			} else {
-				column_colour_data[i] = 0;
-			}
-			col_data <<= 1;
-		}
-		column_colour_data[0] = 0;
-		ledmatrix_update_column(col, column_colour_data);
-	}
-		// Update pong ball colour
-	ledmatrix_update_pixel(START_SCREEN_BALL_X, START_SCREEN_BALL_Y, MATRIX_COLOUR_BALL);
+	animation_start(&start_screen_animation);
 }
 
-// Update dynamic start screen based on the frame number (0-11)
-// Note: this is hardcoded to PONG game.
-// Purposefully obfuscated so functionality cannot be copied for movement tasks
-void update_start_screen(uint8_t frame_number) {
-	
-	if (frame_number < 0 || frame_number > 11) {
-		return;
+// Add the given object to square (x, y) of the game board
+void show_object(uint8_t x, uint8_t y, uint8_t object) {
+	set_layers(x + MATRIX_X_OFFSET, y + MATRIX_Y_OFFSET, 0, OBJECT_LAYER(object));
+}
+
+// Remove the given object from square (x, y) of the game board. Anything
+// underneath it becomes visible.
+void hide_object(uint8_t x, uint8_t y, uint8_t object) {
+	set_layers(x + MATRIX_X_OFFSET, y + MATRIX_Y_OFFSET, OBJECT_LAYER(object), 0);
+}
+
+// Return the top object at square (x, y) of the game board
+uint8_t get_board_object(uint8_t x, uint8_t y) {
+	x += MATRIX_X_OFFSET;
+	y += MATRIX_Y_OFFSET;
+	if (x >= MATRIX_NUM_COLUMNS || y >= MATRIX_NUM_ROWS) {
+		return EMPTY_SQUARE;
 	}
-	
-	// Clear the dynamic columns
-	MatrixColumn column_colour_data[PONG_NUM_DYNAMIC_COLS];
-	for (uint8_t col = 0; col < PONG_NUM_DYNAMIC_COLS; col++) {
-		for (uint8_t row = 0; row < MATRIX_NUM_ROWS; row++) {
-			column_colour_data[col][row] = 0;
+	for (uint8_t i = 0; i < sizeof(OBJECT_ORDER); i++) {
+		if (layers[x][y] & OBJECT_LAYER(OBJECT_ORDER[i])) {
+			return OBJECT_ORDER[i];
 		}
 	}
-	
-	// Set the middle paddle pixel
-	column_colour_data[1][6] = MATRIX_COLOUR_PLAYER;
-	column_colour_data[1][1] = MATRIX_COLOUR_PLAYER;
-	
-	// Set the edge paddle pixel depending on frame number
-	if (frame_number < 3 || frame_number >= 9) {
-		column_colour_data[2][6] = MATRIX_COLOUR_PLAYER;
-	} else {
-		column_colour_data[0][6] = MATRIX_COLOUR_PLAYER;
-	}
-	if (frame_number < 6) {
-		column_colour_data[0][1] = MATRIX_COLOUR_PLAYER;
-	} else {
-		column_colour_data[2][1] = MATRIX_COLOUR_PLAYER;
-	}
-	
-	// Set the ball pixel depending on frame number
-	if (frame_number == 5 || frame_number == 11) {
-		column_colour_data[1][5] = MATRIX_COLOUR_BALL;
-	} else if (frame_number == 0 || frame_number == 4 || frame_number == 6
-			|| frame_number == 10) {
-		column_colour_data[1][4] = MATRIX_COLOUR_BALL;
-	} else if (frame_number == 1 || frame_number == 3 || frame_number == 7
-			|| frame_number == 9) {
-		column_colour_data[1][3] = MATRIX_COLOUR_BALL;
-	} else {
-		column_colour_data[1][2] = MATRIX_COLOUR_BALL;
-	}
-
-	// Update columns
-	for (uint8_t col = 0; col < PONG_NUM_DYNAMIC_COLS; col++) {
-		ledmatrix_update_column(col + PONG_DYNAMIC_COL_START, column_colour_data[col]);
-	}
+	return EMPTY_SQUARE;
 }
 
-// Update the colour of the pixel at position (x, y) on the display to show the
-// provided object
-void update_square_colour(uint8_t x, uint8_t y, uint8_t object) {
-	// determine which colour corresponds to this object
-	PixelColour colour;
-	
-	switch (object) {
-		case EMPTY_SQUARE:
-			colour = MATRIX_COLOUR_EMPTY;
-			break;
-		case PLAYER:
-			colour = MATRIX_COLOUR_PLAYER;
-			break;
-		case BALL:
-			colour = MATRIX_COLOUR_BALL;
-			break;
-		case GUIDE:
-			colour = MATRIX_COLOR_GUIDE;
-			break;
-		// An invalid/unexpected object
-		default:
-			colour = MATRIX_COLOUR_EMPTY;
-			break;
+// Work out the visible colour of every pixel whose layers have changed and
+// write it to the LED matrix framebuffer. Pixels that end up the same colour
+// as before are not sent by ledmatrix_flush().
+void display_compose(void) {
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		if (!changed_layers[x]) {
+			continue;
+		}
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+			if (changed_layers[x] & (1 << y)) {
+				ledmatrix_set_pixel(x, y, layer_colour(layers[x][y]));
+			}
+		}
+		changed_layers[x] = 0;
 	}
-
-	// Update the pixel at the given location with this colour
-	ledmatrix_update_pixel(x + MATRIX_X_OFFSET, y + MATRIX_Y_OFFSET, colour);
 }
 
-// Draw a three by three number from left to right bottom to top
+// Draw a 3x5 digit on the HUD layer whose top right pixel is at
+// (start_x, start_y). Only the lit pixels of the digit are changed.
 void draw_3x3_number(uint8_t start_x, uint8_t start_y, uint8_t num){
-	uint16_t digit = LED_DIGIT_FONTS[num];
-	uint8_t offset_x =  0, offset_y = 0;
-	for(uint8_t bit = 0; bit < 16; bit++){
-		// Check if bit is turned on
-		if(digit & (1<<bit)){
-			ledmatrix_update_pixel(start_x - offset_x, start_y - offset_y, MATRIX_COLOR_SCORE);
-		}
-		if(offset_x == 2){
-			offset_y++;
+	uint8_t left_x = start_x - (FONT_WIDTH - 1);
+	uint8_t bottom_y = start_y - (FONT_HEIGHT - 1);
+	for(uint8_t col = 0; col < FONT_WIDTH; col++){
+		uint8_t pixels = font_column('0' + num, col);
+		for(uint8_t row = 0; row < FONT_HEIGHT; row++){
+			if(pixels & (1 << row)){
+				set_layers(left_x + col, bottom_y + row, HUD_LAYER_MASK, HUD_SCORE);
+			}
 		}
-		offset_x = (offset_x + 1) % 3;
 	}
 }
 
+// Remove the 3x5 area drawn by draw_3x3_number() from the HUD layer
 void clear_3x3_grid(uint8_t start_x, uint8_t start_y){
-	uint8_t offset_x = 0, offset_y = 0;
-	for(uint8_t bit = 0; bit < 16; bit++){
-		// Check if bit is turned on
-		ledmatrix_update_pixel(start_x - offset_x, start_y - offset_y, MATRIX_COLOUR_EMPTY);
-		if(offset_x == 2){
-			offset_y++;
+	uint8_t left_x = start_x - (FONT_WIDTH - 1);
+	uint8_t bottom_y = start_y - (FONT_HEIGHT - 1);
+	for(uint8_t col = 0; col < FONT_WIDTH; col++){
+		for(uint8_t row = 0; row < FONT_HEIGHT; row++){
+			set_layers(left_x + col, bottom_y + row, HUD_LAYER_MASK, 0);
 		}
-		offset_x = (offset_x + 1) % 3;
 	}
 }
 
+// Draw a column of num pixels on the HUD layer, starting from the bottom
 void draw_rally_count(uint8_t x, uint8_t num) {
-	MatrixColumn cols = { 0 };
-	for(uint8_t y = 0; y < num; y++){
-		cols[y] = MATRIX_COLOR_RALLY;
+	for(uint8_t y = 0; y < MATRIX_NUM_ROWS; y++){
+		set_layers(x, y, HUD_LAYER_MASK, (y < num) ? HUD_RALLY : 0);
 	}
-	ledmatrix_update_column(x, cols);
 }
 
 void clear_rally_col(uint8_t x){
-	MatrixColumn cols = { 0 };
-	ledmatrix_update_column(x, cols);
-}
\ No newline at end of file
+	draw_rally_count(x, 0);
+}
+
+// Return column col (0 is the left) of the 3x5 glyph for character c. Bit 4
+// is the top row of the glyph and bit 0 is the bottom row. Lower case
+// letters are shown as upper case and unsupported characters are blank.
+uint8_t font_column(char c, uint8_t col) {
+	if (col >= FONT_WIDTH) {
+		return 0;
+	}
+	if (c >= '0' && c <= '9') {
+		return pgm_read_byte(&LED_DIGIT_COLUMNS[c - '0'][col]);
+	}
+	if (c >= 'a' && c <= 'z') {
+		c -= 'a' - 'A';
+	}
+	if (c >= 'A' && c <= 'Z') {
+		return pgm_read_byte(&LED_LETTER_COLUMNS[c - 'A'][col]);
+	}
+	switch (c) {
+		case '!':
+			return (col == 1) ? 0b11101 : 0;
+		case '-':
+			return 0b00100;
+		default:
+			return 0;
+	}
+}
+
+// Clear the layer bits in clear_mask and then set those in set_mask for
+// pixel (x, y) of the LED matrix. Invalid positions are ignored.
+static void set_layers(uint8_t x, uint8_t y, uint8_t clear_mask, uint8_t set_mask) {
+	if (x >= MATRIX_NUM_COLUMNS || y >= MATRIX_NUM_ROWS) {
+		return;
+	}
+	uint8_t new_layers = (layers[x][y] & ~clear_mask) | set_mask;
+	if (new_layers != layers[x][y]) {
+		layers[x][y] = new_layers;
+		changed_layers[x] |= (1 << y);
+	}
+}
+
+// Return the colour of the top layer in pixel_layers
+static PixelColour layer_colour(uint8_t pixel_layers) {
+	switch (pixel_layers & HUD_LAYER_MASK) {
+		case HUD_SCORE:
+			return MATRIX_COLOR_SCORE;
+		case HUD_RALLY:
+			return MATRIX_COLOR_RALLY;
+		default:
+			break;
+	}
+	for (uint8_t i = 0; i < sizeof(OBJECT_ORDER); i++) {
+		if (pixel_layers & OBJECT_LAYER(OBJECT_ORDER[i])) {
+			return OBJECT_COLOURS[OBJECT_ORDER[i]];
+		}
+	}
+	if (pixel_layers & BORDER_LAYER) {
+		return MATRIX_COLOUR_BORDER;
+	}
+	return MATRIX_COLOUR_EMPTY;
+}
@@ -9,6 +9,7 @@
 #define DISPLAY_H_
 
 #include "pixel_colour.h"
+#include "ledmatrix.h"
 
 // Offset for the LED matrix to cater for any game border offset to the edge
 // of the LED matrix display.
@@ -20,38 +21,47 @@
 #define MATRIX_COLOUR_BORDER	COLOUR_LIGHT_YELLOW
 #define MATRIX_COLOUR_PLAYER	COLOUR_GREEN
 #define MATRIX_COLOUR_BALL		COLOUR_RED
+#define MATRIX_COLOUR_OBSTACLE	COLOUR_LIGHT_YELLOW
 
 #define MATRIX_COLOR_SCORE		COLOUR_ORANGE
 #define MATRIX_COLOR_RALLY		COLOUR_YELLOW
 #define MATRIX_COLOR_GUIDE		COLOUR_LIGHT_GREEN
 
-#define START_SCREEN_BALL_X		(14)
-#define START_SCREEN_BALL_Y		(4)
-
-#define PONG_NUM_DYNAMIC_COLS	(3)
-#define PONG_DYNAMIC_COL_START	(13)
+#define FONT_WIDTH				(3)
+#define FONT_HEIGHT				(5)
 
 #define SCORE_START_Y			(6)
 #define SCORE_1_START_X			(6)
-#define SCORE_2_START_X			(11)
+#define SCORE_2_START_X			(MATRIX_NUM_COLUMNS - 5)
 
 #define RALLY_1_X				(0)
-#define RALLY_2_X				(15)
+#define RALLY_2_X				(MATRIX_NUM_COLUMNS - 1)
 
 // Initialise the display for the board, this creates the display
 // for an empty board.
 void initialise_display(void);
 
-// Shows a starting display.
+// Shows a starting display. The display is animated by animation_think().
 void show_start_screen(void);
 
-// Update dynamic start screen based on frame number (0-11)
-void update_start_screen(uint8_t frame_number);
+// Add or remove an object (see game.h) at square (x, y) of the game board.
+// Each object is drawn on its own layer, so objects can overlap and
+// removing one shows whatever is underneath. The changes are not shown
+// until display_compose() is called.
+void show_object(uint8_t x, uint8_t y, uint8_t object);
+void hide_object(uint8_t x, uint8_t y, uint8_t object);
+
+// Return the object drawn on top at square (x, y) of the game board, or
+// EMPTY_SQUARE if there is none. The HUD is ignored.
+uint8_t get_board_object(uint8_t x, uint8_t y);
 
-// Updates the colour at square (x, y) to be the colour
-// of the object 'object'.
-void update_square_colour(uint8_t x, uint8_t y, uint8_t object);
+// Write the visible colour of every changed pixel to the LED matrix
+// framebuffer. This should be called once per frame, before
+// ledmatrix_flush().
+void display_compose(void);
 
+// The score digits and rally counts are drawn on a HUD layer above the
+// game objects. x and y are LED matrix coordinates.
 void draw_3x3_number(uint8_t start_x, uint8_t start_y, uint8_t num);
 
 void clear_3x3_grid(uint8_t start_x, uint8_t start_y);
@@ -60,4 +70,7 @@ void draw_rally_count(uint8_t x, uint8_t num);
 
 void clear_rally_col(uint8_t x);
 
+// Returns one column of the 3x5 font used for the score. See display.c.
+uint8_t font_column(char c, uint8_t col);
+
 #endif /* DISPLAY_H_ */
@@ -0,0 +1,178 @@
+/*
+ * eventlog.c
+ *
+ * Game event log in a scrolling pane on the terminal.
+ */
+
+#include "eventlog.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "serialio.h"
+#include "terminalio.h"
+#include "timer0.h"
+#include "fmt.h"
+#include "trace.h"
+
+#define EVENTLOG_MASK		(EVENTLOG_LINES - 1)
+
+#if EVENTLOG_BOTTOM > TERMINAL_HEIGHT
+#error "The event log pane must fit on the terminal (see TERMINAL_HEIGHT)"
+#endif
+
+// Most output adding a line can need: the cursor move, the scroll and the
+// line
+#define ADD_MAX_BYTES		(FMT_CURSOR_MAX + 2 + EVENTLOG_LINE_MAX)
+
+#define TRACE_MESSAGE(id, format, text) static const char id##_TEXT[] PROGMEM = text;
+TRACE_MESSAGES
+#undef TRACE_MESSAGE
+
+static PGM_P const MESSAGES[] PROGMEM = {
+#define TRACE_MESSAGE(id, format, text) id##_TEXT,
+	TRACE_MESSAGES
+#undef TRACE_MESSAGE
+};
+
+// The trace records on the pane, oldest first from head - count, with the
+// time in seconds. The last pending of them haven't been sent yet.
+static struct trace_record lines[EVENTLOG_LINES];
+static uint8_t head;
+static uint8_t count;
+static uint8_t pending;
+
+// Set once the scroll region is set and the pane drawn
+static uint8_t pane_drawn;
+static struct eventlog_stats stats;
+
+// Take the new trace records that have text for the pane
+static void read_events(void) {
+	struct trace_record record;
+	while (trace_read_event(&record)) {
+		if (!pgm_read_byte(pgm_read_ptr(&MESSAGES[record.id]))) {
+			continue;
+		}
+		// The record has the low 16 bits of the time it was made, only
+		// just before now
+		uint32_t now = get_current_time();
+		record.time = (now - (uint16_t)((uint16_t)now - record.time)) / 1000;
+		lines[head] = record;
+		head = (head + 1) & EVENTLOG_MASK;
+		if (count < EVENTLOG_LINES) {
+			count++;
+		}
+		if (pending < EVENTLOG_LINES) {
+			pending++;
+		} else {
+			// The oldest waiting line would scroll off the pane anyway
+			stats.lines_skipped++;
+		}
+	}
+}
+
+// The index'th oldest event kept
+static struct trace_record* get_record(uint8_t index) {
+	return &lines[(head - count + index) & EVENTLOG_MASK];
+}
+
+// Write the line for record to buffer (no terminating 0). Returns the
+// number of characters written.
+static uint8_t format_line(char* buffer, struct trace_record* record) {
+	uint8_t length = fmt_uint(buffer, record->time);
+	length += fmt_string_P(&buffer[length], PSTR("s  "));
+	PGM_P format = pgm_read_ptr(&MESSAGES[record->id]);
+	uint8_t arg = 0;
+	char c;
+	while ((c = pgm_read_byte(format++)) &&
+			length <= EVENTLOG_LINE_MAX - FMT_INT_MAX) {
+		if (c == '%' && arg < record->num_args) {
+			length += fmt_int(&buffer[length], record->args[arg++]);
+		} else {
+			buffer[length++] = c;
+		}
+	}
+	return length;
+}
+
+void eventlog_redraw(void) {
+	// Setting the scroll region moves the cursor to the top left
+	set_scroll_region(EVENTLOG_TOP, EVENTLOG_BOTTOM);
+	move_terminal_cursor(1, EVENTLOG_TOP - 1);
+	serial_write_P(PSTR("Events"));
+	eventlog_repaint();
+	pane_drawn = 1;
+}
+
+void eventlog_repaint(void) {
+	uint32_t start_bytes = serial_bytes_output();
+	uint16_t start = get_fine_time();
+
+	// The newest event goes on the bottom row, as when lines are added
+	read_events();
+	char line[EVENTLOG_LINE_MAX];
+	for (uint8_t row = 0; row < EVENTLOG_LINES; row++) {
+		move_terminal_cursor(1, EVENTLOG_TOP + row);
+		clear_to_end_of_line();
+		if (row >= EVENTLOG_LINES - count) {
+			struct trace_record* record =
+					get_record(row - (EVENTLOG_LINES - count));
+			serial_write(line, format_line(line, record));
+		}
+	}
+	pending = 0;
+
+	stats.repaint_time = (uint32_t)(uint16_t)(get_fine_time() - start)
+			* US_PER_FINE_TICK;
+	stats.repaint_bytes = serial_bytes_output() - start_bytes;
+}
+
+void eventlog_think(void) {
+	read_events();
+	if (!pane_drawn) {
+		// eventlog_redraw() will show them
+		return;
+	}
+	while (pending && serial_output_space() >= ADD_MAX_BYTES) {
+		uint32_t start_bytes = serial_bytes_output();
+		uint16_t start = get_fine_time();
+
+		// Scrolling up from the bottom row of the scroll region moves the
+		// pane up a line, leaving the bottom row blank for the new line
+		char line[EVENTLOG_LINE_MAX];
+		move_terminal_cursor(1, EVENTLOG_BOTTOM);
+		scroll_up();
+		serial_write(line, format_line(line, get_record(count - pending)));
+		pending--;
+
+		uint16_t add_bytes = serial_bytes_output() - start_bytes;
+		stats.last_add_time = (uint32_t)(uint16_t)(get_fine_time() - start)
+				* US_PER_FINE_TICK;
+		stats.lines_added++;
+		stats.last_add_bytes = add_bytes;
+		if (add_bytes > stats.max_add_bytes) {
+			stats.max_add_bytes = add_bytes;
+		}
+	}
+}
+
+void eventlog_get_stats(struct eventlog_stats* stats_out) {
+	*stats_out = stats;
+}
+
+// Time to send bytes at the current baud rate (ten bits each), in tenths
+// of a millisecond
+static uint16_t send_time(uint16_t bytes) {
+	return (uint32_t)bytes * 100000 / serial_get_baud();
+}
+
+void eventlog_print_stats(void) {
+	uint16_t add_send_time = send_time(stats.last_add_bytes);
+	uint16_t repaint_send_time = send_time(stats.repaint_bytes);
+	move_terminal_cursor(10,37);
+	clear_to_end_of_line();
+	printf_P(PSTR("Event log add/repaint bytes: %u/%u  ms to send: "
+			"%u.%u/%u.%u  us: %lu/%lu"), stats.last_add_bytes,
+			stats.repaint_bytes, add_send_time / 10, add_send_time % 10,
+			repaint_send_time / 10, repaint_send_time % 10,
+			stats.last_add_time, stats.repaint_time);
+}
@@ -0,0 +1,60 @@
+/*
+ * eventlog.h
+ *
+ * A running log of game events (points, speed changes and so on) in a pane
+ * just below the game's status lines. The events are the trace records (see
+ * trace.h) whose messages have text for the pane, so an event is logged
+ * just once, with TRACEn(). The pane is the terminal's scroll region, so
+ * adding a line is a scroll at the bottom of the pane and the text of the
+ * new line - the terminal moves the older lines up itself and the rows
+ * above the pane (the scores and everything else) are left alone. Sending
+ * every line of the pane again would cost EVENTLOG_LINES times as much.
+ * The pane ends on row EVENTLOG_BOTTOM, so the game and the pane fit on a
+ * standard 24 row terminal.
+ */
+
+#ifndef EVENTLOG_H_
+#define EVENTLOG_H_
+
+#include <stdint.h>
+
+// Terminal rows of the pane (its title is on the row above) and the most
+// characters on one line. Lines start in the first column. EVENTLOG_LINES
+// must be a power of two.
+#define EVENTLOG_TOP		(18)
+#define EVENTLOG_LINES		(4)
+#define EVENTLOG_BOTTOM		(EVENTLOG_TOP + EVENTLOG_LINES - 1)
+#define EVENTLOG_LINE_MAX	(60)
+
+// Set the scroll region to the pane and draw its title and the last
+// EVENTLOG_LINES events. This must be called after the terminal is cleared.
+void eventlog_redraw(void);
+
+// Send every line of the pane again without scrolling. This is what adding
+// a line would cost without the scroll region; eventlog_print_stats()
+// compares the two.
+void eventlog_repaint(void);
+
+// Add the events not yet shown to the pane, as many as fit in the serial
+// output buffer without waiting. If more than EVENTLOG_LINES are waiting
+// only the last EVENTLOG_LINES are sent. This should be called frequently
+// from the main loop.
+void eventlog_think(void);
+
+struct eventlog_stats {
+	uint16_t lines_added;		// by scrolling
+	uint16_t lines_skipped;		// scrolled out before they were sent
+	uint16_t last_add_bytes;
+	uint16_t max_add_bytes;
+	uint32_t last_add_time;		// us spent adding the line
+	uint16_t repaint_bytes;		// last repaint of the whole pane
+	uint32_t repaint_time;		// us
+};
+
+void eventlog_get_stats(struct eventlog_stats* stats);
+
+// Print the byte counts and times to the terminal, with how long each
+// takes to send at the current baud rate
+void eventlog_print_stats(void);
+
+#endif /* EVENTLOG_H_ */
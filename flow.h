@@ -0,0 +1,82 @@
+/*
+ * flow.h
+ *
+ * Resumable functions (protothreads) for sequences that take a while, such
+ * as a screen that waits for a button. A flow function is called over and
+ * over from the main loop. Each call carries on from where the last one
+ * waited and returns as soon as it has to wait again, so nothing else is
+ * held up while it waits.
+ *
+ * The place to carry on from is kept in a struct flow as a line number and
+ * the function body is one big switch on it (FLOW_BEGIN() to FLOW_END()),
+ * with a case at each wait. So:
+ *	- local variables are lost at each wait - keep anything needed after a
+ *	  wait in static variables (or the caller's)
+ *	- there can't be a switch statement around a wait
+ *	- there can only be one wait per line
+ *
+ *	static uint8_t blink(struct flow* f) {
+ *		FLOW_BEGIN(f);
+ *		led_on();
+ *		FLOW_DELAY(f, 500);
+ *		led_off();
+ *		FLOW_END(f);
+ *	}
+ */
+
+#ifndef FLOW_H_
+#define FLOW_H_
+
+#include <stdint.h>
+#include "sched.h"
+
+struct flow {
+	uint16_t line;		// where to carry on from, 0 for the start
+	uint32_t wake_time;	// for FLOW_DELAY()
+};
+
+// Values returned by flow functions
+#define FLOW_WAITING	(0)
+#define FLOW_DONE		(1)
+
+// Start the flow from the beginning on its next call
+#define FLOW_RESET(f)	((f)->line = 0)
+
+#define FLOW_BEGIN(f)	switch ((f)->line) { case 0:
+
+// Finish the flow. It starts from the beginning again if called after this.
+#define FLOW_END(f)		} (f)->line = 0; return FLOW_DONE
+
+// Return until condition is true (which may be straight away)
+#define FLOW_WAIT_UNTIL(f, condition) \
+	do { \
+		(f)->line = __LINE__; case __LINE__: \
+		if (!(condition)) { \
+			return FLOW_WAITING; \
+		} \
+	} while (0)
+
+// Return once, carrying on from here on the next call
+#define FLOW_YIELD(f) \
+	do { \
+		(f)->line = __LINE__; \
+		return FLOW_WAITING; case __LINE__:; \
+	} while (0)
+
+// Return until ms have passed. The time comes from the scheduler (see
+// sched_now()), so the main loop must be running sched_think().
+#define FLOW_DELAY(f, ms) \
+	do { \
+		(f)->wake_time = sched_now() + (ms); \
+		FLOW_WAIT_UNTIL((f), (int32_t)(sched_now() - (f)->wake_time) >= 0); \
+	} while (0)
+
+// Run another flow (call, e.g. start_screen(&child)) until it is done,
+// from its beginning
+#define FLOW_RUN(f, child, call) \
+	do { \
+		FLOW_RESET(child); \
+		FLOW_WAIT_UNTIL((f), (call) == FLOW_DONE); \
+	} while (0)
+
+#endif /* FLOW_H_ */
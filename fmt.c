@@ -0,0 +1,135 @@
+/*
+ * fmt.c
+ *
+ * Small formatters for the text we send to the terminal most often.
+ */
+
+#include "fmt.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "serialio.h"
+#include "terminalio.h"
+#include "timer0.h"
+
+// Powers of ten for fmt_uint(). Dividing by 10 takes a call to the division
+// routine for every digit, so we count subtractions instead.
+static const uint16_t POWERS_OF_TEN[] PROGMEM = { 10000, 1000, 100, 10 };
+
+uint8_t fmt_uint(char* buffer, uint16_t value) {
+	uint8_t length = 0;
+	for (uint8_t i = 0; i < sizeof(POWERS_OF_TEN) / sizeof(POWERS_OF_TEN[0]);
+			i++) {
+		uint16_t power = pgm_read_word(&POWERS_OF_TEN[i]);
+		char digit = '0';
+		while (value >= power) {
+			value -= power;
+			digit++;
+		}
+		// Skip leading zeros
+		if (length || digit != '0') {
+			buffer[length++] = digit;
+		}
+	}
+	buffer[length++] = '0' + value;
+	return length;
+}
+
+uint8_t fmt_int(char* buffer, int16_t value) {
+	uint8_t length = 0;
+	// Negate in unsigned arithmetic, as -(-32768) doesn't fit in an int16_t
+	uint16_t magnitude = (uint16_t)value;
+	if (value < 0) {
+		buffer[length++] = '-';
+		magnitude = 0u - magnitude;
+	}
+	return length + fmt_uint(&buffer[length], magnitude);
+}
+
+uint8_t fmt_string_P(char* buffer, const char* string) {
+	uint8_t length = 0;
+	char c;
+	while ((c = pgm_read_byte(string++))) {
+		buffer[length++] = c;
+	}
+	return length;
+}
+
+uint8_t fmt_cursor(char* buffer, uint8_t x, uint8_t y) {
+	uint8_t length = 0;
+	buffer[length++] = '\x1b';
+	buffer[length++] = '[';
+	length += fmt_uint(&buffer[length], y);
+	buffer[length++] = ';';
+	length += fmt_uint(&buffer[length], x);
+	buffer[length++] = 'H';
+	return length;
+}
+
+uint8_t fmt_attribute(char* buffer, uint8_t parameter) {
+	uint8_t length = 0;
+	buffer[length++] = '\x1b';
+	buffer[length++] = '[';
+	length += fmt_uint(&buffer[length], parameter);
+	buffer[length++] = 'm';
+	return length;
+}
+
+void print_uint(uint16_t value) {
+	char buffer[FMT_UINT_MAX];
+	serial_write(buffer, fmt_uint(buffer, value));
+}
+
+void print_int(int16_t value) {
+	char buffer[FMT_INT_MAX];
+	serial_write(buffer, fmt_int(buffer, value));
+}
+
+// Number of calls timed for each formatter. Timer 0 counts every 64 clock
+// cycles, so this gives a resolution of one cycle per call.
+#define BENCHMARK_CALLS			(64)
+#define CYCLES_PER_FINE_TICK	(64)
+
+// Return the average cycles taken by a formatter over BENCHMARK_CALLS calls,
+// given the fine tick count at the start
+static uint16_t cycles_per_call(uint16_t start) {
+	uint16_t ticks = get_fine_time() - start;
+	return (uint32_t)ticks * CYCLES_PER_FINE_TICK / BENCHMARK_CALLS;
+}
+
+void fmt_benchmark(void) {
+	char buffer[FMT_CURSOR_MAX + 1];
+	// volatile so that the calls can't be moved out of the loops
+	volatile uint8_t x = 42;
+	volatile uint8_t y = 17;
+	volatile uint16_t score = 12345;
+	uint16_t start;
+	
+	start = get_fine_time();
+	for (uint8_t i = 0; i < BENCHMARK_CALLS; i++) {
+		sprintf_P(buffer, PSTR("\x1b[%d;%dH"), y, x);
+	}
+	uint16_t printf_cursor = cycles_per_call(start);
+	start = get_fine_time();
+	for (uint8_t i = 0; i < BENCHMARK_CALLS; i++) {
+		fmt_cursor(buffer, x, y);
+	}
+	uint16_t fmt_cursor_cycles = cycles_per_call(start);
+	
+	start = get_fine_time();
+	for (uint8_t i = 0; i < BENCHMARK_CALLS; i++) {
+		sprintf_P(buffer, PSTR("%u"), score);
+	}
+	uint16_t printf_number = cycles_per_call(start);
+	start = get_fine_time();
+	for (uint8_t i = 0; i < BENCHMARK_CALLS; i++) {
+		fmt_uint(buffer, score);
+	}
+	uint16_t fmt_number = cycles_per_call(start);
+	
+	move_terminal_cursor(10,23);
+	clear_to_end_of_line();
+	printf_P(PSTR("Cycles/call sprintf_P vs fmt - cursor: %u/%u  "
+			"number: %u/%u"), printf_cursor, fmt_cursor_cycles,
+			printf_number, fmt_number);
+}
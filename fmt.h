@@ -0,0 +1,48 @@
+/*
+ * fmt.h
+ *
+ * Small formatters for the text we send to the terminal most often. These
+ * write into a caller supplied buffer with no use of the heap or of the
+ * stdio formatting code, which costs thousands of cycles per call. The
+ * print functions send the result straight to the serial output buffer
+ * (see serial_write()).
+ */
+
+#ifndef FMT_H_
+#define FMT_H_
+
+#include <stdint.h>
+
+// Longest output of each formatter
+#define FMT_UINT_MAX		(5)		// 65535
+#define FMT_INT_MAX			(6)		// -32768
+#define FMT_CURSOR_MAX		(10)	// ESC [ 255 ; 255 H
+
+// Write the decimal digits of value to buffer (no terminating 0). Returns
+// the number of characters written.
+uint8_t fmt_uint(char* buffer, uint16_t value);
+
+// As fmt_uint() but with a leading '-' for negative values
+uint8_t fmt_int(char* buffer, int16_t value);
+
+// Copy a string from program memory to buffer (no terminating 0). Returns
+// the number of characters written.
+uint8_t fmt_string_P(char* buffer, const char* string);
+
+// Write the escape sequence that moves the cursor to column x, row y
+// (both counted from 1). Returns the number of characters written.
+uint8_t fmt_cursor(char* buffer, uint8_t x, uint8_t y);
+
+// Write the escape sequence that sets the given display attribute (see
+// terminalio.h). Returns the number of characters written.
+uint8_t fmt_attribute(char* buffer, uint8_t parameter);
+
+// Send a number to the serial output
+void print_uint(uint16_t value);
+void print_int(int16_t value);
+
+// Time the formatters against the sprintf_P() calls they replace and print
+// the cycles per call to the terminal.
+void fmt_benchmark(void);
+
+#endif /* FMT_H_ */
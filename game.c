@@ -16,8 +16,13 @@
 #include "timer0.h"
 #include "display.h"
 #include "terminalio.h"
+#include "serialio.h"
+#include "fmt.h"
 #include "ssd.h"
 #include "cpu.h"
+#include "trace.h"
+#include "flow.h"
+#include "spi.h"
 
 // Player paddle positions. y coordinate refers to lower pixel on paddle.
 // x coordinates never change but are nice to have here to use when drawing to
@@ -44,8 +49,9 @@ uint8_t gained_point = 0;
 // 1 game is paused, 0 normal operation
 uint8_t game_paused;
 
-// Allow unpausing of the game after a set time
-uint32_t resume_time = 0;
+// Unpausing of the game a set time after a point (see game_think())
+static struct flow resume_flow;
+static uint8_t resume_pending = 0;
 
 // Draw Prototypes
 void draw_player_paddle(uint8_t player_to_draw);
@@ -102,15 +108,18 @@ void initialise_game(void) {
 	reset_ball();
 	
 	// Draw new ball
-	update_square_colour(ball_x, ball_y, BALL);
+	show_object(ball_x, ball_y, BALL);
 	
-	// Set Pin D3 to be an output
+#if SPI_TRANSPORT != SPI_TRANSPORT_USART1
+	// Set Pin D3 (the pause LED) to be an output. (With the USART1
+	// transport D3 sends to the LED matrix, so there is no pause LED.)
 	DDRD |= (1<<DDD3);
+#endif
 }
 
 void reset_ball(void){
 	// Clear the old ball
-	update_square_colour(ball_x, ball_y, EMPTY_SQUARE);
+	hide_object(ball_x, ball_y, BALL);
 	
 	// Reset ball position and direction
 	ball_x = BALL_START_X;
@@ -128,12 +137,13 @@ void update_guide_paddle(int8_t y){
 	draw_guide_paddle();
 }
 
+// The guide is drawn below player 2's paddle so it only shows where they
+// don't overlap
 void draw_guide_paddle(void){
 	int8_t guide_x = PLAYER_X_COORDINATES[PLAYER_2];
 	
 	for (int y = guide_y_coordinate; y < guide_y_coordinate + PLAYER_HEIGHT; y++) {
-		if(y == player_y_coordinates[PLAYER_2] || y == player_y_coordinates[PLAYER_2] + 1) continue;
-		update_square_colour(guide_x, y, GUIDE);
+		show_object(guide_x, y, GUIDE);
 	}
 }
 
@@ -141,8 +151,7 @@ void erase_guide_paddle(void) {
 	int8_t guide_x = PLAYER_X_COORDINATES[PLAYER_2];
 	
 	for (int y = guide_y_coordinate; y < guide_y_coordinate + PLAYER_HEIGHT; y++) {
-		if(y == player_y_coordinates[PLAYER_2] || y == player_y_coordinates[PLAYER_2] + 1) continue;
-		update_square_colour(guide_x, y, EMPTY_SQUARE);
+		hide_object(guide_x, y, GUIDE);
 	}
 }
 
@@ -154,12 +163,7 @@ void draw_player_paddle(uint8_t player_to_draw) {
 	int8_t player_y = player_y_coordinates[player_to_draw];
 
 	for (int y = player_y; y < player_y + PLAYER_HEIGHT; y++) {
-		update_square_colour(player_x, y, PLAYER);
-	}
-	
-	if(is_cpu_enabled() && player_to_draw == PLAYER_2){
-		erase_guide_paddle();
-		draw_guide_paddle();
+		show_object(player_x, y, PLAYER);
 	}
 }
 
@@ -169,7 +173,7 @@ void erase_player_paddle(uint8_t player_to_draw) {
 	int8_t player_y = player_y_coordinates[player_to_draw];
 
 	for (int y = player_y; y < player_y + PLAYER_HEIGHT; y++) {
-		update_square_colour(player_x, y, EMPTY_SQUARE);
+		hide_object(player_x, y, PLAYER);
 	}
 }
 
@@ -215,28 +219,18 @@ void update_ball_position(void) {
 	}
 	
 	// Erase old ball
-	update_square_colour(ball_x, ball_y, EMPTY_SQUARE);
+	hide_object(ball_x, ball_y, BALL);
 	
 	// Assign new ball coordinates
 	ball_x = new_ball_x;
 	ball_y = new_ball_y;
 	
 	// Draw new ball
-	update_square_colour(ball_x, ball_y, BALL);
+	show_object(ball_x, ball_y, BALL);
 }
 
 // Returns 1 if the game is over, 0 otherwise.
 uint8_t is_game_over(void) {
-	if(resume_time){
-		uint32_t current_time = get_current_time();
-		if(current_time >= resume_time){
-			resume_time = 0;
-			reset_ball();
-			toggle_pause();
-			clear_player_score(PLAYER_1);
-			clear_player_score(PLAYER_2);
-		}
-	}
 	return (player_score[PLAYER_1] == WIN_SCORE || player_score[PLAYER_2] == WIN_SCORE);
 }
 
@@ -252,14 +246,26 @@ uint8_t is_game_paused(void){
 uint8_t toggle_pause(void){
 	game_paused ^= 1;
 	if(game_paused){
-		move_terminal_cursor(10,8);
-		printf_P(PSTR("GAME PAUSED!"));
+		TRACE0(TRACE_PAUSE);
+	}else{
+		TRACE0(TRACE_RESUME);
+	}
+	char line[FMT_CURSOR_MAX + 12];
+	uint8_t length = fmt_cursor(line, 10, 8);
+	if(game_paused){
+		length += fmt_string_P(&line[length], PSTR("GAME PAUSED!"));
+#if SPI_TRANSPORT != SPI_TRANSPORT_USART1
 		PORTD |= (1<<PORTD3);
+#endif
 	}else{
-		move_terminal_cursor(10,8);
-		clear_to_end_of_line();
+		// Blank out the message (clearing to the end of the line would
+		// also clear the terminal board)
+		length += fmt_string_P(&line[length], PSTR("            "));
+#if SPI_TRANSPORT != SPI_TRANSPORT_USART1
 		PORTD = (PORTD & ~(1<<PORTD3));
+#endif
 	}
+	serial_write_keyed(SERIAL_KEY_PAUSE, line, length);
 	return game_paused;
 }
 
@@ -358,16 +364,33 @@ int8_t random_y_direction(void){
 	return generate_random_number(-1, 1);
 }
 
+// Send one score line. Each line is a single keyed message so that an
+// out of date score still waiting for the terminal is replaced rather
+// than sent.
+static void display_player_score(int8_t player, uint8_t key, uint8_t y){
+	char line[FMT_CURSOR_MAX + 16 + FMT_INT_MAX];
+	uint8_t length = fmt_cursor(line, 10, y);
+	if(player == PLAYER_1){
+		length += fmt_string_P(&line[length], PSTR("Player 1 Score: "));
+	}else{
+		length += fmt_string_P(&line[length], PSTR("Player 2 Score: "));
+	}
+	length += fmt_int(&line[length], player_score[player]);
+	serial_write_keyed(key, line, length);
+}
+
 void display_players_score(void){
-	move_terminal_cursor(10,10);
-	printf_P(PSTR("Player 1 Score: %d"), player_score[PLAYER_1]);
-	move_terminal_cursor(10,12);
-	printf_P(PSTR("Player 2 Score: %d"), player_score[PLAYER_2]);
+	display_player_score(PLAYER_1, SERIAL_KEY_SCORE_1, 10);
+	display_player_score(PLAYER_2, SERIAL_KEY_SCORE_2, 12);
 }
 
 void add_point(int8_t player){
 	if(gained_point) return;
 	player_score[player] += 1;
+	// A rally count of -1 means no hits yet
+	TRACE4(TRACE_POINT, player + 1, player_score[PLAYER_1],
+			player_score[PLAYER_2],
+			player_rally[PLAYER_1] + player_rally[PLAYER_2] + 2);
 	
 	gained_point = 1;
 	
@@ -378,9 +401,25 @@ void add_point(int8_t player){
 	draw_player_score(PLAYER_2);
 	if(!is_game_over()){
 		toggle_pause();
-		// Wait 1500ms before resuming
-		uint32_t current_time = get_current_time();
-		resume_time = current_time + 1500;
+		FLOW_RESET(&resume_flow);
+		resume_pending = 1;
+	}
+}
+
+// Show the score for a while, then carry on with a new ball
+static uint8_t resume_after_point(struct flow* f){
+	FLOW_BEGIN(f);
+	FLOW_DELAY(f, POINT_PAUSE_MS);
+	reset_ball();
+	toggle_pause();
+	clear_player_score(PLAYER_1);
+	clear_player_score(PLAYER_2);
+	FLOW_END(f);
+}
+
+void game_think(void){
+	if(resume_pending && resume_after_point(&resume_flow) == FLOW_DONE){
+		resume_pending = 0;
 	}
 }
 
@@ -396,6 +435,10 @@ void clear_player_score(int8_t player){
 	clear_3x3_grid(score_start_x[player], SCORE_START_Y);
 }
 
+int8_t get_player_rally(int8_t player){
+	return player_rally[player];
+}
+
 void reset_rally_counters(void){
 	reset_rally_counter(PLAYER_1);
 	reset_rally_counter(PLAYER_2);
@@ -408,20 +451,52 @@ void reset_rally_counter(int8_t player){
 
 void increment_rally_counter(int8_t player) {
 	player_rally[player] += 1;
+	TRACE2(TRACE_HIT, player + 1, player_rally[player]);
 	// Fast Modulus 8
 	uint8_t num = (player_rally[player] & ( 8 - 1)) + 1;
 	draw_rally_count(rally_start_x[player], num);
 }
 
-static uint8_t game_speed = SLOW_GAME_SPEED; // Current Game Speed
-static const uint32_t game_speeds[] = {500, 300, 200}; // Possible Game Speeds
+static const uint16_t game_speeds[] = {500, 300, 200}; // Possible Game Speeds
+static uint16_t ball_period = 500; // Current ms between ball moves
 
 uint32_t get_game_speed(void){
-	return game_speeds[game_speed];
+	return ball_period;
 }
 
 void set_game_speed(uint8_t speed){
-	game_speed = speed;
+	ball_period = game_speeds[speed];
+	TRACE1(TRACE_SPEED, ball_period);
+}
+
+void set_ball_period(uint16_t period_ms){
+	ball_period = period_ms;
+	TRACE1(TRACE_SPEED, ball_period);
+}
+
+void display_game_speed(void){
+	// Each name is padded to the longest so we don't get mashed words.
+	// (Clearing to the end of the line would also clear the terminal
+	// board.)
+	char line[FMT_CURSOR_MAX + 20 + 8];
+	uint8_t length = fmt_cursor(line, 10, 5);
+	length += fmt_string_P(&line[length], PSTR("Current Ball Speed: "));
+	if(ball_period == game_speeds[SLOW_GAME_SPEED]){
+		length += fmt_string_P(&line[length], PSTR("Slow    "));
+	}else if(ball_period == game_speeds[MEDIUM_GAME_SPEED]){
+		length += fmt_string_P(&line[length], PSTR("Medium  "));
+	}else if(ball_period == game_speeds[FAST_GAME_SPEED]){
+		length += fmt_string_P(&line[length], PSTR("Fast    "));
+	}else{
+		// Any other speed set by a serial command
+		uint8_t start = length;
+		length += fmt_uint(&line[length], ball_period);
+		length += fmt_string_P(&line[length], PSTR(" ms"));
+		while(length < start + 8){
+			line[length++] = ' ';
+		}
+	}
+	serial_write_keyed(SERIAL_KEY_SPEED, line, length);
 }
 
 void get_ball_data(struct ball_data* bd){
@@ -12,6 +12,7 @@
 #define GAME_H_
 
 #include <stdint.h>
+#include "ledmatrix.h"
 
 // Ball directions
 #define LEFT				(-1)
@@ -24,8 +25,9 @@
 #define BALL_START_Y_DIR	(STATIONARY)
 
 // Game board dimensions (x and y axis are as per LED matrix i.e. x is the
-// longer axis)
-#define BOARD_WIDTH			(12)
+// longer axis). The board fills the display apart from the rally count and
+// border columns at each end, so it grows with the number of panels.
+#define BOARD_WIDTH			(MATRIX_NUM_COLUMNS - 4)
 #define BOARD_HEIGHT		(8)
 #define GAME_BORDER_WIDTH	(1)
 
@@ -86,6 +88,13 @@ void update_ball_position(void);
 // Returns 1 if the game is over, 0 otherwise.
 uint8_t is_game_over(void);
 
+// Time the game stays paused after a point (ms)
+#define POINT_PAUSE_MS		(1500)
+
+// Carry on with anything the game is waiting to do, i.e. resuming after a
+// point. This should be called frequently while a game is being played.
+void game_think(void);
+
 uint8_t get_winner(void);
 
 // Returns 1 if game is paused, 0 otherwise
@@ -103,10 +112,19 @@ void display_players_score(void);
 
 int8_t get_player_score(int8_t player);
 
+// Returns the number of hits in the current rally, or -1 before the first
+int8_t get_player_rally(int8_t player);
+
 uint32_t get_game_speed(void);
 
 void set_game_speed(uint8_t speed);
 
+// Set any time between ball moves, rather than one of the speeds above
+void set_ball_period(uint16_t period_ms);
+
+// Show the ball speed on the terminal
+void display_game_speed(void);
+
 void get_ball_data(struct ball_data*);
 
 int8_t get_player_y(int8_t player);
@@ -9,8 +9,13 @@
 #include "ledmatrix.h"
 #include <stdint.h>
 #include <avr/io.h>
+#include <avr/eeprom.h>
 #include "spi.h"
 
+#if LEDMATRIX_NUM_PANELS < 1 || LEDMATRIX_NUM_PANELS > SPI_MAX_SLAVES
+#error "LEDMATRIX_NUM_PANELS must be between 1 and SPI_MAX_SLAVES"
+#endif
+
 #define CMD_UPDATE_ALL		(0x00)
 #define CMD_UPDATE_PIXEL	(0x01)
 #define CMD_UPDATE_ROW		(0x02)
@@ -18,20 +23,111 @@
 #define CMD_SHIFT_DISPLAY	(0x04)
 #define CMD_CLEAR_SCREEN	(0x0F)
 
+// Number of bytes sent to a panel by each of the update commands
+#define CMD_UPDATE_ALL_BYTES	(1 + PANEL_NUM_COLUMNS * MATRIX_NUM_ROWS)
+#define CMD_UPDATE_PIXEL_BYTES	(3)
+#define CMD_UPDATE_ROW_BYTES	(2 + PANEL_NUM_COLUMNS)
+#define CMD_UPDATE_COL_BYTES	(2 + MATRIX_NUM_ROWS)
+
+// Panel that a display column is on, and the column number within the panel
+#define PANEL_OF(x)			((x) / PANEL_NUM_COLUMNS)
+#define PANEL_COLUMN(x)		((x) % PANEL_NUM_COLUMNS)
+
+// Shadow copies of the display. frame holds what the display should show
+// after the next flush and shown holds what has been sent to the panels.
+// A bit is set in dirty_columns[panel] for each column of that panel that
+// has been written in frame since the last flush.
+static MatrixData frame;
+static MatrixData shown;
+static uint16_t dirty_columns[LEDMATRIX_NUM_PANELS];
+
+#if LEDMATRIX_NUM_PANELS > 1
+// Panel that queued commands are currently going to
+static uint8_t selected_panel;
+#endif
+
+// Counters for the bytes sent by ledmatrix_flush()
+static struct ledmatrix_stats stats;
+
+// 1 if bytes are sent with spi_send_byte() rather than queued
+static uint8_t blocking;
+
+// Current link settings, and the copy saved in EEPROM. The saved copy is
+// only used if magic and check are right (check is the complement of the
+// other bytes XORed together).
+#define LINK_MAGIC 0xA5
+struct saved_link {
+	uint8_t magic;
+	struct ledmatrix_link link;
+	uint8_t check;
+};
+static struct ledmatrix_link link;
+static struct saved_link EEMEM saved_link;
+
+static void send_byte(uint8_t byte);
+static void end_command(void);
+static uint8_t link_check(const struct saved_link* saved);
+static uint8_t valid_clock_divider(uint8_t clock_divider);
+static void select_panel(uint8_t panel_number);
+static void mark_column_dirty(uint8_t x);
+static void clear_dirty_columns(void);
+static uint16_t flush_panel(uint8_t panel_number, uint16_t* num_changed);
+static void send_panel_all(uint8_t panel_number);
+static void send_panel_row(uint8_t panel_number, uint8_t y);
+static uint8_t changed_rows_in_column(uint8_t x);
+static uint8_t column_cost(uint8_t changed_mask);
+static uint8_t count_bits(uint8_t value);
+
 void ledmatrix_setup(void) {
-	// Setup SPI - we divide the clock by 128.
+	// Setup SPI - by default we divide the clock by 128.
 	// (This speed guarantees the SPI buffer will never overflow on
-	// the LED matrix.)
-	spi_setup_master(128);
+	// the LED matrix.) A faster setting found by calibration is used
+	// instead if one has been saved.
+	struct saved_link saved;
+	eeprom_read_block(&saved, &saved_link, sizeof(saved));
+	if (saved.magic == LINK_MAGIC && saved.check == link_check(&saved)
+			&& valid_clock_divider(saved.link.clock_divider)) {
+		link = saved.link;
+	} else {
+		link.clock_divider = LEDMATRIX_DEFAULT_CLOCK_DIVIDER;
+		link.command_gap = 0;
+	}
+	spi_setup_master(link.clock_divider);
+#if LEDMATRIX_NUM_PANELS > 1
+	spi_setup_slaves(LEDMATRIX_NUM_PANELS);
+	selected_panel = 0;
+#endif
+}
+
+void ledmatrix_set_link(const struct ledmatrix_link* new_link) {
+	if (!valid_clock_divider(new_link->clock_divider)) {
+		return;
+	}
+	link = *new_link;
+	spi_set_clock_divider(link.clock_divider);
+}
+
+void ledmatrix_get_link(struct ledmatrix_link* link_out) {
+	*link_out = link;
+}
+
+void ledmatrix_save_link(void) {
+	struct saved_link saved;
+	saved.magic = LINK_MAGIC;
+	saved.link = link;
+	saved.check = link_check(&saved);
+	eeprom_update_block(&saved, &saved_link, sizeof(saved));
 }
 
 void ledmatrix_update_all(MatrixData data) {
-	(void)spi_send_byte(CMD_UPDATE_ALL);
-	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
-		for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
-			(void)spi_send_byte(data[x][y]);
-		}
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		copy_matrix_column(data[x], frame[x]);
+	}
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		send_panel_all(panel_number);
 	}
+	clear_dirty_columns();
 }
 
 void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel) {
@@ -39,9 +135,13 @@ void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel) {
 		// Position isn't valid - we ignore the request.
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_PIXEL);
-	(void)spi_send_byte(((y & 0x07) << 4) | (x & 0x0F));
-	(void)spi_send_byte(pixel);
+	select_panel(PANEL_OF(x));
+	send_byte(CMD_UPDATE_PIXEL);
+	send_byte(((y & 0x07) << 4) | (PANEL_COLUMN(x) & 0x0F));
+	send_byte(pixel);
+	end_command();
+	frame[x][y] = pixel;
+	shown[x][y] = pixel;
 }
 
 void ledmatrix_update_row(uint8_t y, MatrixRow row) {
@@ -49,10 +149,12 @@ void ledmatrix_update_row(uint8_t y, MatrixRow row) {
 		// y value is too large - we ignore the request
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_ROW);
-	(void)spi_send_byte(y & 0x07);	// row number
 	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
-		(void)spi_send_byte(row[x]);
+		frame[x][y] = row[x];
+	}
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		send_panel_row(panel_number, y);
 	}
 }
 
@@ -61,35 +163,391 @@ void ledmatrix_update_column(uint8_t x, MatrixColumn col) {
 		// x value is too large - we ignore the request
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_COL);
-	(void)spi_send_byte(x & 0x0F); // column number
+	select_panel(PANEL_OF(x));
+	send_byte(CMD_UPDATE_COL);
+	send_byte(PANEL_COLUMN(x) & 0x0F); // column number
 	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
-		(void)spi_send_byte(col[y]);
+		send_byte(col[y]);
+		frame[x][y] = col[y];
+		shown[x][y] = col[y];
 	}
+	end_command();
 }
 
+// The shift commands move the display contents one pixel in the given
+// direction and blank the column or row that is shifted in. We shift our
+// shadow copies (and the dirty bits) the same way. Each panel shifts on its
+// own, so for a horizontal shift the columns that should have moved across
+// from a neighbouring panel are marked dirty and sent on the next flush.
 void ledmatrix_shift_display_left(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x02);
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		select_panel(panel_number);
+		send_byte(CMD_SHIFT_DISPLAY);
+		send_byte(0x02);
+		end_command();
+	}
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS - 1; x++) {
+		copy_matrix_column(frame[x + 1], frame[x]);
+		if (PANEL_COLUMN(x) == PANEL_NUM_COLUMNS - 1) {
+			set_matrix_column_to_colour(shown[x], COLOUR_BLACK);
+		} else {
+			copy_matrix_column(shown[x + 1], shown[x]);
+		}
+	}
+	set_matrix_column_to_colour(frame[MATRIX_NUM_COLUMNS - 1], COLOUR_BLACK);
+	set_matrix_column_to_colour(shown[MATRIX_NUM_COLUMNS - 1], COLOUR_BLACK);
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		dirty_columns[panel_number] >>= 1;
+		if (panel_number + 1 < LEDMATRIX_NUM_PANELS) {
+			dirty_columns[panel_number] |= (1U << (PANEL_NUM_COLUMNS - 1));
+		}
+	}
 }
 
 void ledmatrix_shift_display_right(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x01);
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		select_panel(panel_number);
+		send_byte(CMD_SHIFT_DISPLAY);
+		send_byte(0x01);
+		end_command();
+	}
+	for (uint8_t x = MATRIX_NUM_COLUMNS - 1; x > 0; x--) {
+		copy_matrix_column(frame[x - 1], frame[x]);
+		if (PANEL_COLUMN(x) == 0) {
+			set_matrix_column_to_colour(shown[x], COLOUR_BLACK);
+		} else {
+			copy_matrix_column(shown[x - 1], shown[x]);
+		}
+	}
+	set_matrix_column_to_colour(frame[0], COLOUR_BLACK);
+	set_matrix_column_to_colour(shown[0], COLOUR_BLACK);
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		dirty_columns[panel_number] <<= 1;
+		if (panel_number > 0) {
+			dirty_columns[panel_number] |= 1;
+		}
+	}
 }
 
 void ledmatrix_shift_display_up(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x08);
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		select_panel(panel_number);
+		send_byte(CMD_SHIFT_DISPLAY);
+		send_byte(0x08);
+		end_command();
+	}
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		for (uint8_t y = MATRIX_NUM_ROWS - 1; y > 0; y--) {
+			frame[x][y] = frame[x][y - 1];
+			shown[x][y] = shown[x][y - 1];
+		}
+		frame[x][0] = COLOUR_BLACK;
+		shown[x][0] = COLOUR_BLACK;
+	}
 }
 
 void ledmatrix_shift_display_down(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x04);
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		select_panel(panel_number);
+		send_byte(CMD_SHIFT_DISPLAY);
+		send_byte(0x04);
+		end_command();
+	}
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS - 1; y++) {
+			frame[x][y] = frame[x][y + 1];
+			shown[x][y] = shown[x][y + 1];
+		}
+		frame[x][MATRIX_NUM_ROWS - 1] = COLOUR_BLACK;
+		shown[x][MATRIX_NUM_ROWS - 1] = COLOUR_BLACK;
+	}
 }
 
 void ledmatrix_clear(void) {
-	(void)spi_send_byte(CMD_CLEAR_SCREEN);
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		select_panel(panel_number);
+		send_byte(CMD_CLEAR_SCREEN);
+		end_command();
+	}
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		set_matrix_column_to_colour(frame[x], COLOUR_BLACK);
+		set_matrix_column_to_colour(shown[x], COLOUR_BLACK);
+	}
+	clear_dirty_columns();
+}
+
+void ledmatrix_set_pixel(uint8_t x, uint8_t y, PixelColour pixel) {
+	if (x >= MATRIX_NUM_COLUMNS || y >= MATRIX_NUM_ROWS) {
+		// Position isn't valid - we ignore the request.
+		return;
+	}
+	frame[x][y] = pixel;
+	mark_column_dirty(x);
+}
+
+void ledmatrix_set_column(uint8_t x, MatrixColumn col) {
+	if (x >= MATRIX_NUM_COLUMNS) {
+		// x value is too large - we ignore the request
+		return;
+	}
+	copy_matrix_column(col, frame[x]);
+	mark_column_dirty(x);
+}
+
+void ledmatrix_blit_column(uint8_t x, uint8_t area, uint8_t pixels,
+		PixelColour colour, PixelColour background) {
+	if (x >= MATRIX_NUM_COLUMNS) {
+		// x value is too large - we ignore the request
+		return;
+	}
+	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+		if (area & (1 << y)) {
+			frame[x][y] = (pixels & (1 << y)) ? colour : background;
+		}
+	}
+	mark_column_dirty(x);
+}
+
+PixelColour ledmatrix_get_pixel(uint8_t x, uint8_t y) {
+	if (x >= MATRIX_NUM_COLUMNS || y >= MATRIX_NUM_ROWS) {
+		return COLOUR_BLACK;
+	}
+	return frame[x][y];
+}
+
+// Send the changes in the framebuffer. Panels with no dirty columns are
+// skipped, so the cost of a flush depends on what changed rather than on
+// the number of panels.
+void ledmatrix_flush(void) {
+	uint16_t frame_bytes = 0;
+	uint16_t num_changed = 0;
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		if (dirty_columns[panel_number]) {
+			frame_bytes += flush_panel(panel_number, &num_changed);
+		}
+	}
+	if (!num_changed) {
+		return;
+	}
+	
+	stats.frames++;
+	stats.last_frame_bytes = frame_bytes;
+	stats.last_frame_saved = num_changed * CMD_UPDATE_PIXEL_BYTES - frame_bytes;
+	stats.bytes_sent += stats.last_frame_bytes;
+	stats.bytes_saved += stats.last_frame_saved;
+}
+
+void ledmatrix_get_stats(struct ledmatrix_stats* stats_out) {
+	*stats_out = stats;
+}
+
+void ledmatrix_reset_stats(void) {
+	stats = (struct ledmatrix_stats){ 0 };
+}
+
+void ledmatrix_set_blocking(uint8_t blocking_in) {
+	spi_flush();
+	blocking = blocking_in;
+}
+
+static void send_byte(uint8_t byte) {
+	if (blocking) {
+		spi_send_byte(byte);
+	} else {
+		spi_enqueue(byte);
+	}
+}
+
+// Give the panel time to process a command before the next one
+static void end_command(void) {
+	spi_enqueue_pause(link.command_gap);
+}
+
+static uint8_t link_check(const struct saved_link* saved) {
+	return ~(saved->magic ^ saved->link.clock_divider
+			^ saved->link.command_gap);
+}
+
+static uint8_t valid_clock_divider(uint8_t clock_divider) {
+	switch (clock_divider) {
+		case 2: /* FALLTHROUGH */
+		case 4: /* FALLTHROUGH */
+		case 8: /* FALLTHROUGH */
+		case 16: /* FALLTHROUGH */
+		case 32: /* FALLTHROUGH */
+		case 64: /* FALLTHROUGH */
+		case 128:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// Direct the following commands to the given panel
+static void select_panel(uint8_t panel_number) {
+#if LEDMATRIX_NUM_PANELS > 1
+	if (panel_number != selected_panel) {
+		spi_enqueue_select(panel_number);
+		selected_panel = panel_number;
+	}
+#else
+	(void)panel_number;
+#endif
+}
+
+static void mark_column_dirty(uint8_t x) {
+	dirty_columns[PANEL_OF(x)] |= (1U << PANEL_COLUMN(x));
+}
+
+static void clear_dirty_columns(void) {
+	for (uint8_t panel_number = 0; panel_number < LEDMATRIX_NUM_PANELS;
+			panel_number++) {
+		dirty_columns[panel_number] = 0;
+	}
+}
+
+// Send the changes to one panel using the combination of commands that
+// takes the fewest bytes. Each changed cell can be covered by a pixel
+// command, its column's command, its row's command or an update of the whole
+// panel. We try every combination of the changed rows being sent as row
+// commands; for each one the remaining cells in a column are covered by
+// pixel commands or one column command, whichever is cheaper. The number of
+// changed pixels is added to num_changed and the bytes sent are returned.
+static uint16_t flush_panel(uint8_t panel_number, uint16_t* num_changed) {
+	uint8_t first_x = panel_number * PANEL_NUM_COLUMNS;
+	
+	// Work out which cells really changed. Bit y of changed[x] is set if
+	// pixel (first_x + x, y) differs from the panel.
+	uint8_t changed[PANEL_NUM_COLUMNS];
+	uint8_t changed_rows = 0;
+	uint8_t panel_changed = 0;
+	for (uint8_t x = 0; x < PANEL_NUM_COLUMNS; x++) {
+		changed[x] = 0;
+		if (dirty_columns[panel_number] & (1U << x)) {
+			changed[x] = changed_rows_in_column(first_x + x);
+			changed_rows |= changed[x];
+			panel_changed += count_bits(changed[x]);
+		}
+	}
+	dirty_columns[panel_number] = 0;
+	if (!panel_changed) {
+		return 0;
+	}
+	*num_changed += panel_changed;
+	
+	// Find the cheapest set of rows to send as row commands
+	uint16_t best_cost = CMD_UPDATE_ALL_BYTES;
+	uint8_t best_rows = 0;
+	uint8_t use_update_all = 1;
+	uint8_t rows = changed_rows;
+	while (1) {
+		uint16_t cost = count_bits(rows) * CMD_UPDATE_ROW_BYTES;
+		for (uint8_t x = 0; x < PANEL_NUM_COLUMNS && cost < best_cost; x++) {
+			cost += column_cost(changed[x] & ~rows);
+		}
+		if (cost < best_cost) {
+			best_cost = cost;
+			best_rows = rows;
+			use_update_all = 0;
+		}
+		if (!rows) {
+			break;
+		}
+		// Next subset of the changed rows
+		rows = (rows - 1) & changed_rows;
+	}
+	
+	if (use_update_all) {
+		send_panel_all(panel_number);
+		return best_cost;
+	}
+	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+		if (best_rows & (1 << y)) {
+			send_panel_row(panel_number, y);
+		}
+	}
+	for (uint8_t x = 0; x < PANEL_NUM_COLUMNS; x++) {
+		uint8_t remaining = changed[x] & ~best_rows;
+		if (column_cost(remaining) == CMD_UPDATE_COL_BYTES) {
+			ledmatrix_update_column(first_x + x, frame[first_x + x]);
+		} else {
+			for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+				if (remaining & (1 << y)) {
+					ledmatrix_update_pixel(first_x + x, y,
+							frame[first_x + x][y]);
+				}
+			}
+		}
+	}
+	return best_cost;
+}
+
+// Send the part of the framebuffer on the given panel with an update all
+// command
+static void send_panel_all(uint8_t panel_number) {
+	uint8_t first_x = panel_number * PANEL_NUM_COLUMNS;
+	select_panel(panel_number);
+	send_byte(CMD_UPDATE_ALL);
+	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+		for (uint8_t x = first_x; x < first_x + PANEL_NUM_COLUMNS; x++) {
+			send_byte(frame[x][y]);
+			shown[x][y] = frame[x][y];
+		}
+	}
+	end_command();
+}
+
+// Send row y of the framebuffer on the given panel with an update row
+// command
+static void send_panel_row(uint8_t panel_number, uint8_t y) {
+	uint8_t first_x = panel_number * PANEL_NUM_COLUMNS;
+	select_panel(panel_number);
+	send_byte(CMD_UPDATE_ROW);
+	send_byte(y & 0x07);	// row number
+	for (uint8_t x = first_x; x < first_x + PANEL_NUM_COLUMNS; x++) {
+		send_byte(frame[x][y]);
+		shown[x][y] = frame[x][y];
+	}
+	end_command();
+}
+
+// Return a mask with bit y set if pixel (x, y) of the framebuffer differs
+// from the LED matrix
+static uint8_t changed_rows_in_column(uint8_t x) {
+	uint8_t mask = 0;
+	for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+		if (frame[x][y] != shown[x][y]) {
+			mask |= (1 << y);
+		}
+	}
+	return mask;
+}
+
+// Return the number of bytes needed to update the pixels of one column
+// given by the bits of changed_mask
+static uint8_t column_cost(uint8_t changed_mask) {
+	uint8_t pixel_cost = count_bits(changed_mask) * CMD_UPDATE_PIXEL_BYTES;
+	if (pixel_cost > CMD_UPDATE_COL_BYTES) {
+		return CMD_UPDATE_COL_BYTES;
+	}
+	return pixel_cost;
+}
+
+static uint8_t count_bits(uint8_t value) {
+	uint8_t count = 0;
+	while (value) {
+		value &= value - 1;
+		count++;
+	}
+	return count;
 }
 
 void copy_matrix_column(MatrixColumn from, MatrixColumn to) {
@@ -10,10 +10,18 @@
 #include <stdint.h>
 #include "pixel_colour.h"
 
-// The matrix has 16 columns (x ranges from 0 to 15, left to right) and
-// 8 rows (y ranges from 0 to 7, bottom to top) - as per the X,Y
-// coordinates marked on the board.
-#define MATRIX_NUM_COLUMNS 16
+// Each LED matrix panel has 16 columns and 8 rows. Several panels can be
+// placed side by side to make a wider display - panel 0 is on the left and
+// each panel has its own SPI slave select line (see spi_setup_slaves()).
+#ifndef LEDMATRIX_NUM_PANELS
+#define LEDMATRIX_NUM_PANELS 1
+#endif
+#define PANEL_NUM_COLUMNS 16
+
+// The display has 16 columns per panel (x ranges from 0 to 15 on a single
+// panel, left to right) and 8 rows (y ranges from 0 to 7, bottom to top) -
+// as per the X,Y coordinates marked on the board.
+#define MATRIX_NUM_COLUMNS (PANEL_NUM_COLUMNS * LEDMATRIX_NUM_PANELS)
 #define MATRIX_NUM_ROWS 8
 
 // Data types which can be used to store display information
@@ -26,7 +34,26 @@ typedef PixelColour MatrixColumn[MATRIX_NUM_ROWS];
 // below are used.
 void ledmatrix_setup(void);
 
+// Settings for the SPI link to the LED matrix. clock_divider is passed to
+// spi_setup_master() and command_gap is a pause after every command (in
+// timer 0 fine ticks, see spi_enqueue_pause()) to give the panel time to
+// process it.
+#define LEDMATRIX_DEFAULT_CLOCK_DIVIDER 128
+struct ledmatrix_link {
+	uint8_t clock_divider;
+	uint8_t command_gap;
+};
+
+// Change the link settings. Invalid clock dividers are ignored. The
+// settings saved with ledmatrix_save_link() (in EEPROM) are used by
+// ledmatrix_setup(), otherwise the default divider and no gap are used.
+void ledmatrix_set_link(const struct ledmatrix_link* link);
+void ledmatrix_get_link(struct ledmatrix_link* link);
+void ledmatrix_save_link(void);
+
 // Functions to update the display
+// Commands are added to the SPI transmit queue (see spi_enqueue()) and these
+// functions return without waiting for them to be sent.
 // For those functions which take an x or a y value, the value must be valid
 // or the request will be ignored. (i.e. x must be < MATRIX_NUM_COLUMNS
 // and y must be < MATRIX_NUM_ROWS)
@@ -40,6 +67,45 @@ void ledmatrix_shift_display_up(void);
 void ledmatrix_shift_display_down(void);
 void ledmatrix_clear(void);
 
+// Send the commands from the functions above with spi_send_byte(), which
+// waits for each byte to be sent, instead of queueing them (if blocking is
+// 1). This is only used to compare the two when benchmarking.
+void ledmatrix_set_blocking(uint8_t blocking);
+
+// Functions to update the shadow framebuffer. These do not communicate with
+// the LED matrix - the changes are sent the next time ledmatrix_flush() is
+// called. Invalid positions are ignored as above.
+void ledmatrix_set_pixel(uint8_t x, uint8_t y, PixelColour pixel);
+void ledmatrix_set_column(uint8_t x, MatrixColumn col);
+PixelColour ledmatrix_get_pixel(uint8_t x, uint8_t y);
+
+// Merge pixels into column x of the shadow framebuffer. Bit y of each mask
+// refers to row y. Rows set in area are changed - to colour if the row is
+// also set in pixels, otherwise to background. Other rows are left alone.
+// This bypasses the game's layers (see display.c), so it is only for
+// screens drawn while they aren't composed, i.e. the game over marquee.
+void ledmatrix_blit_column(uint8_t x, uint8_t area, uint8_t pixels,
+		PixelColour colour, PixelColour background);
+
+// Send the pixels of the shadow framebuffer that differ from what is on the
+// LED matrix, using whichever mix of pixel, row, column and update-all
+// commands needs the fewest bytes. Only panels with changed pixels are sent
+// anything. This should be called once per frame.
+void ledmatrix_flush(void);
+
+// Byte counts for ledmatrix_flush(). Savings are relative to sending one
+// pixel command for every changed pixel.
+struct ledmatrix_stats {
+	uint32_t frames;			// Flushes that sent at least one command
+	uint32_t bytes_sent;
+	uint32_t bytes_saved;
+	uint16_t last_frame_bytes;
+	uint16_t last_frame_saved;
+};
+
+void ledmatrix_get_stats(struct ledmatrix_stats* stats);
+void ledmatrix_reset_stats(void);
+
 // Functions to operate on MatrixRow and MatrixColumn data structures
 void copy_matrix_column(MatrixColumn from, MatrixColumn to);
 void copy_matrix_row(MatrixRow from, MatrixRow to);
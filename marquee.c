@@ -0,0 +1,79 @@
+/*
+ * marquee.c
+ *
+ * Scrolls text across the LED matrix using the matrix's shift command.
+ */
+
+#include "marquee.h"
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "ledmatrix.h"
+#include "display.h"
+#include "timer0.h"
+
+// Each character is the font width plus a blank column
+#define CHARACTER_WIDTH		(FONT_WIDTH + 1)
+
+static PGM_P marquee_text;
+static uint16_t marquee_length;		// Columns in one pass, including the gap
+static uint16_t marquee_position;	// Next column to draw
+static PixelColour marquee_colour;
+static uint16_t marquee_step_time = MARQUEE_DEFAULT_STEP_TIME;
+static uint32_t next_step_time;
+
+void marquee_start(PGM_P text, PixelColour colour) {
+	marquee_text = text;
+	marquee_length = strlen_P(text) * CHARACTER_WIDTH + MATRIX_NUM_COLUMNS;
+	marquee_position = 0;
+	marquee_colour = colour;
+	next_step_time = get_current_time();
+}
+
+void marquee_stop(void) {
+	marquee_text = 0;
+}
+
+uint8_t marquee_is_running(void) {
+	return marquee_text != 0;
+}
+
+void marquee_set_step_time(uint16_t step_time) {
+	marquee_step_time = step_time;
+}
+
+void marquee_think(void) {
+	if (!marquee_text) {
+		return;
+	}
+	uint32_t current_time = get_current_time();
+	if (current_time < next_step_time) {
+		return;
+	}
+	
+	// Work out which column of which character comes in next. Past the end
+	// of the text we scroll in blank columns.
+	uint8_t pixels = 0;
+	uint16_t text_columns = marquee_length - MATRIX_NUM_COLUMNS;
+	if (marquee_position < text_columns) {
+		char c = pgm_read_byte(&marquee_text[marquee_position / CHARACTER_WIDTH]);
+		pixels = font_column(c, marquee_position % CHARACTER_WIDTH);
+	}
+	
+	// Shifting blanks the right hand column so we only need to draw the
+	// lit pixels in it. This writes the framebuffer directly rather than
+	// through the game's layers: they have no shift, so every step would
+	// redraw the whole matrix instead of one shift command and a column.
+	// The marquee only runs after the game is over, and the next game
+	// clears the matrix before it draws its layers.
+	ledmatrix_shift_display_left();
+	pixels <<= MARQUEE_BOTTOM_Y;
+	ledmatrix_blit_column(MATRIX_NUM_COLUMNS - 1, pixels, pixels,
+			marquee_colour, COLOUR_BLACK);
+	ledmatrix_flush();
+	
+	marquee_position++;
+	if (marquee_position >= marquee_length) {
+		marquee_position = 0;
+	}
+	next_step_time = current_time + marquee_step_time;
+}
@@ -0,0 +1,41 @@
+/*
+ * marquee.h
+ *
+ * Scrolls text from right to left across the LED matrix. Each step shifts
+ * the whole display one column left with the matrix's shift command and
+ * then draws only the new right hand column, so a step costs at most
+ * 2 + 10 bytes of SPI traffic. Anything else on the display scrolls off
+ * with the text.
+ */
+
+#ifndef MARQUEE_H_
+#define MARQUEE_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "pixel_colour.h"
+
+// Bottom row of the text. The 3x5 font then covers rows 2 to 6.
+#define MARQUEE_BOTTOM_Y			(2)
+
+// Default time between steps (ms)
+#define MARQUEE_DEFAULT_STEP_TIME	(100)
+
+// Start scrolling the given text (which must be in program memory, e.g.
+// from PSTR()). The text repeats, with a blank display width between each
+// repeat, until marquee_stop() is called.
+void marquee_start(PGM_P text, PixelColour colour);
+
+void marquee_stop(void);
+
+// Returns 1 if text is scrolling, 0 otherwise
+uint8_t marquee_is_running(void);
+
+// Set the time between steps (ms)
+void marquee_set_step_time(uint16_t step_time);
+
+// Scroll one column if a step is due. This should be called frequently
+// from the main loop.
+void marquee_think(void);
+
+#endif /* MARQUEE_H_ */
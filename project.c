@@ -14,6 +14,7 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
 
 
@@ -31,17 +32,39 @@
 #include "adc.h"
 #include "cpu.h"
 #include "sound.h"
+#include "animation.h"
+#include "marquee.h"
+#include "render.h"
+#include "calibrate.h"
+#include "termboard.h"
+#include "fmt.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "command.h"
+#include "eventlog.h"
+#include "sched.h"
+#include "flow.h"
 
 // Function prototypes - these are defined below (after main()) in the order
 // given here
 void initialise_hardware(void);
-void start_screen(void);
+uint8_t run_game(struct flow* f);
+uint8_t start_screen(struct flow* f);
 void new_game(void);
-void play_game(void);
-void handle_game_over(void);
-void draw_game_speed(int8_t speed);
+uint8_t play_game(struct flow* f);
+uint8_t handle_game_over(struct flow* f);
 void handle_serial_input(char input);
 void handle_keyboard_movement(int8_t move);
+void print_serial_stats(void);
+void change_baud_rate(void);
+void init_tasks(void);
+
+// Time between sends of held and logged output to the terminal (ms)
+#define OUTPUT_PERIOD_MS	(4)
+
+// Scheduler tasks (see init_tasks())
+static uint8_t input_task, ball_task, cpu_task, guide_task, adc_task,
+		render_task, termboard_task, output_task, tunes_task;
 
 
 /////////////////////////////// main //////////////////////////////////
@@ -50,16 +73,29 @@ int main(void) {
 	// interrupts.
 	initialise_hardware();
 	
-	// Show the splash screen message. Returns when display
-	// is complete.
-	start_screen();
-	
-	// Loop forever and continuously play the game.
+	// Everything happens in scheduler tasks or in the screens run by
+	// run_game(), one step each time round this loop. Nothing waits in a
+	// loop of its own, so the music, animations and terminal output all
+	// keep going whatever screen we are on.
+	struct flow game_flow;
+	FLOW_RESET(&game_flow);
+	while(1) {
+		sched_think();
+		(void)run_game(&game_flow);
+	}
+}
+
+// Show the splash screen until it is dismissed, then play games forever
+uint8_t run_game(struct flow* f) {
+	static struct flow screen;
+	FLOW_BEGIN(f);
+	FLOW_RUN(f, &screen, start_screen(&screen));
 	while(1) {
 		new_game();
-		play_game();
-		handle_game_over();
+		FLOW_RUN(f, &screen, play_game(&screen));
+		FLOW_RUN(f, &screen, handle_game_over(&screen));
 	}
+	FLOW_END(f);
 }
 
 void initialise_hardware(void) {
@@ -69,8 +105,11 @@ void initialise_hardware(void) {
 	// Setup serial port for 19200 baud communication with no echo
 	// of incoming characters
 	init_serial_stdio(19200, 0);
+	init_terminal();
 	
 	init_timer0();
+	init_render();
+	init_tasks();
 	
 	// Seed random values
 	srand(time(NULL));
@@ -85,7 +124,9 @@ void initialise_hardware(void) {
 	sei();
 }
 
-void start_screen(void) {
+uint8_t start_screen(struct flow* f) {
+	FLOW_BEGIN(f);
+	
 	// Clear terminal screen and output a message
 	clear_terminal();
 	show_cursor();
@@ -98,21 +139,19 @@ void start_screen(void) {
 	// to be pushed or a serial input of 's'
 	show_start_screen();
 
-	uint32_t last_screen_update, current_time;
-	last_screen_update = get_current_time();
-	
-	uint8_t frame_number = 0;
-	
 	Tunes_Play_Mario();
 	
 	// Wait until a button is pressed, or 's' is pressed on the terminal
 	while(1) {
+		FLOW_YIELD(f);
+		
 		// First check for if a 's' is pressed
 		// There are two steps to this
-		// 1) collect any serial input (if available)
+		// 1) collect any serial input (if available), carrying out any
+		//    commands (see command.h)
 		// 2) check if the input is equal to the character 's'
 		// If the serial input is 's', then exit the start screen
-		char serial_input = get_serial_input();
+		char serial_input = command_think();
 		char lower_input = (char)tolower(serial_input);
 		if (lower_input == 's') {
 			break;
@@ -120,6 +159,15 @@ void start_screen(void) {
 		if(lower_input == 'm'){
 			toggle_mute();
 		}
+		if(lower_input == 'c'){
+			// Calibrate the LED matrix link then start the animation again
+			animation_stop();
+			calibrate_matrix_link();
+			show_start_screen();
+		}
+		if(lower_input == 'u'){
+			change_baud_rate();
+		}
 		// Next check for any button presses
 		int8_t btn = button_pushed();
 		btn |= adc_move();
@@ -127,17 +175,13 @@ void start_screen(void) {
 			break;
 		}
 
-		current_time = get_current_time();
-		if (current_time - last_screen_update > 500) {
-			update_start_screen(frame_number);
-			frame_number = (frame_number + 1) % 12;
-			last_screen_update = current_time;
-		}
-		if(Tunes_IsPlaying()) Tunes_Think();
+		animation_think();
 		if(!Tunes_IsPlaying()) Tunes_Play_Mario();
 	}
 	
+	animation_stop();
 	Tunes_Stop();
+	FLOW_END(f);
 }
 
 void new_game(void) {
@@ -146,117 +190,111 @@ void new_game(void) {
 	
 	// Initialise the game and display
 	initialise_game();
+	termboard_redraw();
+	eventlog_redraw();
 	
-	draw_game_speed(get_game_speed());
+	display_game_speed();
+	TRACE1(TRACE_GAME_START, get_game_speed());
 	
 	// Clear a button push or serial input if any are waiting
 	// (The cast to void means the return value is ignored.)
 	(void)button_pushed();
-	clear_serial_input_buffer();
+	command_clear_input();
 	(void)adc_move();
 }
 
-uint32_t remaining_time, next_ball_move_time, current_time = 0;
 int8_t btn; // The button pushed
 
-void play_game(void) {
-	char input; // Serial input
+uint8_t play_game(struct flow* f) {
+	FLOW_BEGIN(f);
+	
+	// Never wait for the terminal while playing - output that doesn't
+	// fit is dropped
+	serial_set_output_policy(SERIAL_DROP);
+	command_set_game_active(1);
 	
-	next_ball_move_time = get_current_time();
+	// Start the game's tasks. The ball moves straight away.
+	sched_start(input_task, 0);
+	sched_start(ball_task, 0);
+	sched_start(cpu_task, CPU_MOVE_DELAY);
+	sched_start(guide_task, CPU_MOVE_DELAY);
+	sched_start(render_task, 0);
+	sched_start(termboard_task, 0);
 	
 	// We play the game until it's over
 	while (!is_game_over()) {
-				
-		// We need to check if any button has been pushed, this will be
-		// NO_BUTTON_PUSHED if no button has been pushed
-		// Checkout the function comment in `buttons.h` and the implementation
-		// in `buttons.c`.
-		btn = button_pushed();
-		
-		btn |= adc_move();
-		
-		input = get_serial_input();
-		
-		handle_serial_input(input);
-		
-		handle_player_move(btn);
-		
-		cpu_think();
-		guide_think();
-		
-		if(Tunes_IsPlaying()) Tunes_Think();
-		
-		current_time = get_current_time();
-		if(is_game_paused()) continue;
-		if (current_time >= next_ball_move_time) {
-			// 500ms (0.5 second) has passed since the last time we move the
-			// ball, so update the position of the ball based on current x
-			// direction and y direction
-			update_ball_position();
-			
-			// set the next move time for the ball 
-			next_ball_move_time = current_time + get_game_speed();
-		}
+		FLOW_YIELD(f);
+		game_think();
 	}
 	// We get here if the game is over.
 	
+	sched_stop(input_task);
+	sched_stop(ball_task);
+	sched_stop(cpu_task);
+	sched_stop(guide_task);
+	sched_stop(render_task);
+	sched_stop(termboard_task);
+	
+	// Show the final state of the board
+	render_frame();
+	serial_set_output_policy(SERIAL_BLOCK);
+	command_set_game_active(0);
+	
 	Tunes_Stop();
+	FLOW_END(f);
 }
 
-void handle_game_over() {
+uint8_t handle_game_over(struct flow* f) {
+	FLOW_BEGIN(f);
+	
+
 	move_terminal_cursor(10,14);
 	printf_P(PSTR("GAME OVER"));
 	move_terminal_cursor(10,15);
 	printf_P(PSTR("Press a button or 's'/'S' to start a new game"));
 	
 	Tunes_Play_star();
+	TRACE1(TRACE_GAME_OVER, get_winner());
+	
+	// Scroll the result across the LED matrix
+	if (get_winner() == 1) {
+		marquee_start(PSTR("GAME OVER - P1 WINS"), MATRIX_COLOR_SCORE);
+	} else {
+		marquee_start(PSTR("GAME OVER - P2 WINS"), MATRIX_COLOR_SCORE);
+	}
 	
 	// Do nothing until a button is pushed. Hint: 's'/'S' should also start a
 	// new game
-	while (button_pushed() == NO_BUTTON_PUSHED && !start_input_pressed()) {
-		char serial_input = get_serial_input();
-		if((char)tolower(serial_input) == 'm') toggle_mute();
-		if(Tunes_IsPlaying()) Tunes_Think(); // wait
+	while(1) {
+		FLOW_YIELD(f);
+		if(button_pushed() != NO_BUTTON_PUSHED) break;
+		char serial_input = (char)tolower(command_think());
+		if(serial_input == 's') break;
+		if(serial_input == 'm') toggle_mute();
+		marquee_think();
 	}
 	
+	marquee_stop();
 	Tunes_Stop();
-}
-
-void draw_game_speed(int8_t speed) {
-	char game_speed[] = "Slow";
-	
-	switch(speed){
-		case FAST_GAME_SPEED:
-			strcpy(game_speed, "Fast");
-			break;
-		case MEDIUM_GAME_SPEED:
-			strcpy(game_speed, "Medium");
-			break;
-		default:
-			break;
-	}
-	
-	move_terminal_cursor(10,5);
-	// Clear the line so we don't get mashed words
-	clear_to_end_of_line();
-	printf_P(PSTR("Current Ball Speed: %s"), game_speed);
+	FLOW_END(f);
 }
 
 void handle_serial_input(char input){
+	uint8_t policy;
 	
 	// Check inputs that can't be lowered first
 	switch(input){
 		case '1':
 			set_game_speed(SLOW_GAME_SPEED);
-			draw_game_speed(SLOW_GAME_SPEED);
+			display_game_speed();
 			break;
 		case '2':
 			set_game_speed(MEDIUM_GAME_SPEED);
-			draw_game_speed(MEDIUM_GAME_SPEED);
+			display_game_speed();
 			break;
 		case '3':
 			set_game_speed(FAST_GAME_SPEED);
-			draw_game_speed(FAST_GAME_SPEED);
+			display_game_speed();
 			break;
 		default:
 			break;
@@ -282,11 +320,7 @@ void handle_serial_input(char input){
 			handle_keyboard_movement(INPUT_W_PRESSED);
 			break;
 		case 'p':
-			if(toggle_pause()){
-				remaining_time = next_ball_move_time - current_time;
-			}else{
-				next_ball_move_time = current_time + remaining_time;
-			}
+			toggle_pause();
 			break;
 		case 'c':
 			toggle_cpu_enabled();
@@ -294,6 +328,48 @@ void handle_serial_input(char input){
 		case 'm':
 			toggle_mute();
 			break;
+		case 'f':
+			// The stats were asked for, so wait for them to be sent
+			policy = serial_set_output_policy(SERIAL_BLOCK);
+			render_print_stats();
+			termboard_print_stats();
+			print_serial_stats();
+			eventlog_print_stats();
+			serial_set_output_policy(policy);
+			break;
+		case 't':
+			termboard_set_enabled(!termboard_is_enabled());
+			break;
+		case 'b':
+			policy = serial_set_output_policy(SERIAL_BLOCK);
+			render_benchmark_transport();
+			serial_set_output_policy(policy);
+			break;
+		case 'g':
+			policy = serial_set_output_policy(SERIAL_BLOCK);
+			fmt_benchmark();
+			serial_set_output_policy(policy);
+			break;
+		case 'e':
+			// Send the whole event log again, to compare with adding
+			// a line (see 'f')
+			policy = serial_set_output_policy(SERIAL_BLOCK);
+			eventlog_repaint();
+			serial_set_output_policy(policy);
+			break;
+		case 'r':
+			policy = serial_set_output_policy(SERIAL_BLOCK);
+			sched_print_stats();
+			serial_set_output_policy(policy);
+			break;
+		case 'y':
+			telemetry_set_enabled(!telemetry_is_enabled());
+			break;
+		case 'u':
+			policy = serial_set_output_policy(SERIAL_BLOCK);
+			change_baud_rate();
+			serial_set_output_policy(policy);
+			break;
 		default:
 			break;
 	}
@@ -301,4 +377,127 @@ void handle_serial_input(char input){
 
 void handle_keyboard_movement(int8_t move){
 	btn |= move;
-}
\ No newline at end of file
+}
+
+////////////////////////////////// tasks //////////////////////////////////
+
+// Act on any button pushes, joystick moves and serial input. (Button pushes
+// and serial input are queued, so running every millisecond is enough.)
+static void handle_input(void) {
+	// We need to check if any button has been pushed, this will be
+	// NO_BUTTON_PUSHED if no button has been pushed
+	// Checkout the function comment in `buttons.h` and the implementation
+	// in `buttons.c`.
+	btn = button_pushed();
+	btn |= adc_move();
+	handle_serial_input(command_think());
+	handle_player_move(btn);
+}
+
+// Move the ball, then run again after the current ball period. While the
+// game is paused (with 'p' or after a point) the ball stays where it is.
+static void move_ball(void) {
+	if(!is_game_paused()){
+		update_ball_position();
+		telemetry_send_state();
+	}
+	sched_start(ball_task, get_game_speed());
+}
+
+// Send any display changes to the LED matrix. The render tick happens
+// every RENDER_PERIOD_MS too, so there is one to act on each time.
+static void render(void) {
+	(void)render_think();
+}
+
+// Send any held and logged output to the terminal
+static void send_output(void) {
+	serial_output_think();
+	eventlog_think();
+	trace_think();
+}
+
+static void play_tunes(void) {
+	if(Tunes_IsPlaying()) Tunes_Think();
+}
+
+// Register the tasks. The ADC, output and music run all the time; the rest
+// only while a game is being played (see play_game()).
+void init_tasks(void) {
+	init_sched();
+	input_task = sched_add(handle_input, 1, PSTR("input"));
+	ball_task = sched_add(move_ball, 0, PSTR("ball"));
+	cpu_task = sched_add(cpu_think, CPU_MOVE_DELAY, PSTR("cpu"));
+	guide_task = sched_add(guide_think, CPU_MOVE_DELAY, PSTR("guide"));
+	render_task = sched_add(render, RENDER_PERIOD_MS, PSTR("render"));
+	termboard_task = sched_add(termboard_think, TERMBOARD_PERIOD_MS,
+			PSTR("termboard"));
+	adc_task = sched_add(adc_think, ADC_READ_PERIOD_MS, PSTR("adc"));
+	output_task = sched_add(send_output, OUTPUT_PERIOD_MS, PSTR("output"));
+	tunes_task = sched_add(play_tunes, 1, PSTR("tunes"));
+	sched_start(adc_task, 0);
+	sched_start(output_task, 0);
+	sched_start(tunes_task, 0);
+}
+
+void print_serial_stats(void){
+	struct serial_output_stats stats;
+	struct telemetry_stats telemetry;
+	struct trace_stats trace;
+	serial_get_output_stats(&stats);
+	telemetry_get_stats(&telemetry);
+	trace_get_stats(&trace);
+	struct serial_lane_stats* hud = &stats.lanes[SERIAL_LANE_HUD];
+	struct serial_lane_stats* bulk = &stats.lanes[SERIAL_LANE_BULK];
+	move_terminal_cursor(10,24);
+	clear_to_end_of_line();
+	printf_P(PSTR("Serial HUD/bulk used: %u/%u  max: %u/%u  dropped "
+			"writes: %u/%u  chars: %u/%u  coalesced: %u"), hud->used,
+			bulk->used, hud->max_used, bulk->max_used, hud->dropped_writes,
+			bulk->dropped_writes, hud->dropped_chars, bulk->dropped_chars,
+			stats.coalesced);
+	move_terminal_cursor(10,25);
+	clear_to_end_of_line();
+	printf_P(PSTR("Telemetry frames sent/dropped: %u/%u  trace records "
+			"sent/dropped: %u/%u"), telemetry.frames_sent,
+			telemetry.frames_dropped, trace.sent, trace.dropped);
+	struct terminal_stats terminal;
+	terminal_get_stats(&terminal);
+	move_terminal_cursor(10,35);
+	clear_to_end_of_line();
+	printf_P(PSTR("Terminal cursor moves: %u  bytes saved: %lu"),
+			terminal.moves, terminal.bytes_saved);
+}
+
+// Show the standard baud rates with the error we would get at each, then
+// move to the next faster one which is accurate enough (going back to the
+// slowest after the fastest). The terminal has to be switched to match.
+void change_baud_rate(void){
+	uint32_t current = serial_get_baud();
+	uint32_t first = 0;
+	uint32_t next = 0;
+	for(uint8_t i = 0; i < SERIAL_NUM_BAUD_RATES; i++){
+		uint32_t rate = serial_baud_rate(i);
+		uint8_t double_speed;
+		int16_t error = serial_baud_error(rate, &double_speed);
+		uint8_t usable = abs(error) <= SERIAL_MAX_BAUD_ERROR;
+		move_terminal_cursor(10,26 + i);
+		clear_to_end_of_line();
+		printf_P(PSTR("%6lu baud %s error %c%d.%d%% %S"), rate,
+				double_speed ? "U2X" : "   ", error < 0 ? '-' : ' ',
+				abs(error) / 10, abs(error) % 10,
+				rate == current ? PSTR("<- current") :
+				usable ? PSTR("") : PSTR("(too far out)"));
+		if(usable){
+			if(!first) first = rate;
+			if(!next && rate > current) next = rate;
+		}
+	}
+	if(!next) next = first;
+	move_terminal_cursor(10,26 + SERIAL_NUM_BAUD_RATES);
+	clear_to_end_of_line();
+	printf_P(PSTR("Switching to %lu baud - set the terminal to match"),
+			next);
+	TRACE1(TRACE_BAUD, next / 100);
+	serial_set_baud(next);
+}
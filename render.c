@@ -0,0 +1,141 @@
+/*
+ * render.c
+ *
+ * Fixed rate rendering of the LED matrix.
+ */
+
+#include "render.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "ledmatrix.h"
+#include "display.h"
+#include "spi.h"
+#include "timer0.h"
+#include "terminalio.h"
+
+static uint32_t frames;
+static uint32_t total_build_ticks;
+static uint32_t total_spi_bytes;
+static uint16_t min_build_ticks;
+static uint16_t max_build_ticks;
+static uint16_t max_spi_bytes;
+
+void init_render(void) {
+	render_reset_stats();
+	set_render_period(RENDER_PERIOD_MS);
+}
+
+uint8_t render_think(void) {
+	if (!render_tick_occurred()) {
+		return 0;
+	}
+	
+	struct ledmatrix_stats matrix_stats;
+	ledmatrix_get_stats(&matrix_stats);
+	uint32_t bytes_before = matrix_stats.bytes_sent;
+	uint16_t start = get_fine_time();
+	
+	render_frame();
+	
+	uint16_t build_ticks = get_fine_time() - start;
+	ledmatrix_get_stats(&matrix_stats);
+	uint16_t spi_bytes = matrix_stats.bytes_sent - bytes_before;
+	
+	frames++;
+	total_build_ticks += build_ticks;
+	total_spi_bytes += spi_bytes;
+	if (frames == 1 || build_ticks < min_build_ticks) {
+		min_build_ticks = build_ticks;
+	}
+	if (build_ticks > max_build_ticks) {
+		max_build_ticks = build_ticks;
+	}
+	if (spi_bytes > max_spi_bytes) {
+		max_spi_bytes = spi_bytes;
+	}
+	return 1;
+}
+
+void render_frame(void) {
+	display_compose();
+	ledmatrix_flush();
+}
+
+void render_get_stats(struct render_stats* stats) {
+	stats->frames = frames;
+	stats->min_build_time = (uint32_t)min_build_ticks * US_PER_FINE_TICK;
+	stats->max_build_time = (uint32_t)max_build_ticks * US_PER_FINE_TICK;
+	if (frames) {
+		stats->avg_build_time = total_build_ticks * US_PER_FINE_TICK / frames;
+		stats->avg_spi_bytes = total_spi_bytes / frames;
+	} else {
+		stats->avg_build_time = 0;
+		stats->avg_spi_bytes = 0;
+	}
+	stats->max_spi_bytes = max_spi_bytes;
+}
+
+void render_reset_stats(void) {
+	frames = 0;
+	total_build_ticks = 0;
+	total_spi_bytes = 0;
+	min_build_ticks = 0;
+	max_build_ticks = 0;
+	max_spi_bytes = 0;
+}
+
+void render_print_stats(void) {
+	struct render_stats stats;
+	render_get_stats(&stats);
+	
+	move_terminal_cursor(10,38);
+	clear_to_end_of_line();
+	printf_P(PSTR("Frames: %lu  Build time (us) min/avg/max: %lu/%lu/%lu"),
+			stats.frames, stats.min_build_time, stats.avg_build_time,
+			stats.max_build_time);
+	move_terminal_cursor(10,39);
+	clear_to_end_of_line();
+	printf_P(PSTR("SPI bytes/frame avg/max: %u/%u  SPI queue peak: %u"),
+			stats.avg_spi_bytes, stats.max_spi_bytes,
+			spi_tx_high_water_mark());
+}
+
+void render_benchmark_transport(void) {
+	MatrixData data;
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+			data[x][y] = ledmatrix_get_pixel(x, y);
+		}
+	}
+	uint16_t frame_bytes = (1 + PANEL_NUM_COLUMNS * MATRIX_NUM_ROWS)
+			* LEDMATRIX_NUM_PANELS;
+	
+	// Resend the current frame one byte at a time with spi_send_byte()
+	ledmatrix_set_blocking(1);
+	uint16_t start = get_fine_time();
+	ledmatrix_update_all(data);
+	uint32_t blocking_time = (uint32_t)(uint16_t)(get_fine_time() - start)
+			* US_PER_FINE_TICK;
+	ledmatrix_set_blocking(0);
+	
+	// and again through the transmit queue. The CPU is only busy until the
+	// last byte is queued.
+	start = get_fine_time();
+	ledmatrix_update_all(data);
+	uint32_t queue_time = (uint32_t)(uint16_t)(get_fine_time() - start)
+			* US_PER_FINE_TICK;
+	spi_flush();
+	uint32_t queued_time = (uint32_t)(uint16_t)(get_fine_time() - start)
+			* US_PER_FINE_TICK;
+	
+	move_terminal_cursor(10,40);
+	clear_to_end_of_line();
+	printf_P(PSTR("%S frame of %u bytes - spi_send_byte: %lu us, %lu bytes/ms"),
+			SPI_TRANSPORT == SPI_TRANSPORT_USART1 ? PSTR("USART1") : PSTR("SPI0"),
+			frame_bytes, blocking_time, frame_bytes * 1000UL / blocking_time);
+	move_terminal_cursor(10,41);
+	clear_to_end_of_line();
+	printf_P(PSTR("queued: %lu us, %lu bytes/ms, CPU busy %lu us"),
+			queued_time, frame_bytes * 1000UL / queued_time, queue_time);
+}
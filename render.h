@@ -0,0 +1,52 @@
+/*
+ * render.h
+ *
+ * Fixed rate rendering of the LED matrix. Game code draws into the display
+ * layers (see display.h) whenever it likes, and render_think() composes
+ * and sends the changes at most once per render period, so the display
+ * latency and the SPI traffic per frame are bounded.
+ */
+
+#ifndef RENDER_H_
+#define RENDER_H_
+
+#include <stdint.h>
+
+// Frames per second, driven by the timer 0 render tick
+#define RENDER_FRAME_RATE	(50)
+#define RENDER_PERIOD_MS	(1000 / RENDER_FRAME_RATE)
+
+// Frame statistics. Times are in microseconds.
+struct render_stats {
+	uint32_t frames;
+	uint32_t min_build_time;
+	uint32_t avg_build_time;
+	uint32_t max_build_time;
+	uint16_t avg_spi_bytes;
+	uint16_t max_spi_bytes;
+};
+
+// Start the render tick.
+void init_render(void);
+
+// Send the current frame to the LED matrix if a render tick has occurred.
+// Returns 1 if a frame was sent, 0 otherwise. This should be called
+// frequently from the main loop.
+uint8_t render_think(void);
+
+// Compose and send the current frame straight away, without waiting for a
+// render tick.
+void render_frame(void);
+
+void render_get_stats(struct render_stats* stats);
+void render_reset_stats(void);
+
+// Print the frame statistics (and SPI queue usage) to the terminal
+void render_print_stats(void);
+
+// Time how long it takes to send a whole frame to the LED matrix, with
+// spi_send_byte() and through the transmit queue, and print the results to
+// the terminal. Build with each SPI_TRANSPORT to compare the transports.
+void render_benchmark_transport(void);
+
+#endif /* RENDER_H_ */
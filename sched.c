@@ -0,0 +1,199 @@
+/*
+ * sched.c
+ *
+ * Timer wheel scheduler for the main loop.
+ */
+
+#include "sched.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "timer0.h"
+#include "terminalio.h"
+
+#define SCHED_WHEEL_MASK	(SCHED_WHEEL_SLOTS - 1)
+
+// End of a list in the wheel
+#define END_OF_LIST			(0xFF)
+
+// Task states
+#define TASK_IDLE			(0)
+#define TASK_WAITING		(1)		// in the wheel
+#define TASK_RUNNING		(2)
+
+struct task {
+	void (*function)(void);
+	PGM_P name;
+	uint16_t period;
+	uint8_t state;
+	uint8_t next;			// next task in the same slot
+	uint32_t deadline;
+	struct sched_task_stats stats;
+};
+
+static struct task tasks[SCHED_MAX_TASKS];
+static uint8_t num_tasks;
+
+// First task in each slot
+static uint8_t wheel[SCHED_WHEEL_SLOTS];
+
+// Every task due at or before wheel_time has been run
+static uint32_t wheel_time;
+
+void init_sched(void) {
+	for (uint8_t slot = 0; slot < SCHED_WHEEL_SLOTS; slot++) {
+		wheel[slot] = END_OF_LIST;
+	}
+	num_tasks = 0;
+	wheel_time = get_current_time();
+}
+
+uint8_t sched_add(void (*function)(void), uint16_t period, PGM_P name) {
+	if (num_tasks == SCHED_MAX_TASKS) {
+		return SCHED_NO_TASK;
+	}
+	struct task* task = &tasks[num_tasks];
+	task->function = function;
+	task->name = name;
+	task->period = period;
+	task->state = TASK_IDLE;
+	return num_tasks++;
+}
+
+static void insert_task(uint8_t number) {
+	struct task* task = &tasks[number];
+	// A deadline that has already gone by is run on the next millisecond
+	if ((int32_t)(task->deadline - wheel_time) <= 0) {
+		task->deadline = wheel_time + 1;
+	}
+	uint8_t slot = task->deadline & SCHED_WHEEL_MASK;
+	task->next = wheel[slot];
+	wheel[slot] = number;
+	task->state = TASK_WAITING;
+}
+
+static void remove_task(uint8_t number) {
+	uint8_t* link = &wheel[tasks[number].deadline & SCHED_WHEEL_MASK];
+	while (*link != number) {
+		link = &tasks[*link].next;
+	}
+	*link = tasks[number].next;
+}
+
+void sched_start(uint8_t number, uint16_t delay) {
+	struct task* task = &tasks[number];
+	if (task->state == TASK_WAITING) {
+		remove_task(number);
+	}
+	task->deadline = get_current_time() + delay;
+	insert_task(number);
+}
+
+void sched_stop(uint8_t number) {
+	if (tasks[number].state == TASK_WAITING) {
+		remove_task(number);
+	}
+	tasks[number].state = TASK_IDLE;
+}
+
+uint16_t sched_time_left(uint8_t number) {
+	struct task* task = &tasks[number];
+	if (task->state != TASK_WAITING) {
+		return 0;
+	}
+	int32_t time_left = task->deadline - get_current_time();
+	return time_left > 0 ? time_left : 0;
+}
+
+static void run_task(uint8_t number) {
+	struct task* task = &tasks[number];
+	uint16_t late = wheel_time - task->deadline;
+	task->state = TASK_RUNNING;
+
+	uint16_t start = get_fine_time();
+	task->function();
+	uint32_t time = (uint32_t)(uint16_t)(get_fine_time() - start)
+			* US_PER_FINE_TICK;
+	if (time > UINT16_MAX) {
+		time = UINT16_MAX;
+	}
+
+	// Move the average 1/SCHED_AVERAGE_RUNS of the way to this run's time
+	task->stats.average_time += ((int32_t)time - task->stats.average_time)
+			/ SCHED_AVERAGE_RUNS;
+	if (time > task->stats.max_time) {
+		task->stats.max_time = time;
+	}
+	if (late > task->stats.max_late) {
+		task->stats.max_late = late;
+	}
+
+	if (task->state != TASK_RUNNING) {
+		// The task started or stopped itself
+		return;
+	}
+	if (!task->period) {
+		task->state = TASK_IDLE;
+		return;
+	}
+	if (late >= task->period) {
+		task->stats.overruns++;
+		task->deadline = wheel_time + task->period;
+	} else {
+		task->deadline += task->period;
+	}
+	insert_task(number);
+}
+
+void sched_think(void) {
+	uint32_t current_time = get_current_time();
+	uint32_t elapsed = current_time - wheel_time;
+	if (!elapsed) {
+		return;
+	}
+	// Look at the slot for each millisecond since the last call (each slot
+	// once if it has been a whole turn of the wheel or more)
+	uint8_t slot = wheel_time + 1;
+	uint8_t num_slots = elapsed < SCHED_WHEEL_SLOTS ? elapsed :
+			SCHED_WHEEL_SLOTS;
+	wheel_time = current_time;
+	while (num_slots--) {
+		slot &= SCHED_WHEEL_MASK;
+		// Start from the front of the list again after each task, as it
+		// may have started or stopped others
+		uint8_t number = wheel[slot];
+		while (number != END_OF_LIST) {
+			if ((int32_t)(tasks[number].deadline - current_time) <= 0) {
+				remove_task(number);
+				run_task(number);
+				number = wheel[slot];
+			} else {
+				number = tasks[number].next;
+			}
+		}
+		slot++;
+	}
+}
+
+uint32_t sched_now(void) {
+	return wheel_time;
+}
+
+void sched_get_stats(uint8_t number, struct sched_task_stats* stats) {
+	*stats = tasks[number].stats;
+}
+
+void sched_print_stats(void) {
+	move_terminal_cursor(10,SCHED_STATS_ROW);
+	clear_to_end_of_line();
+	printf_P(PSTR("Task        period  us avg/max  late max  overruns"));
+	for (uint8_t i = 0; i < num_tasks; i++) {
+		struct task* task = &tasks[i];
+		move_terminal_cursor(10,SCHED_STATS_ROW + 1 + i);
+		clear_to_end_of_line();
+		printf_P(PSTR("%-10S  %6u  %5u/%5u  %8u  %8u"), task->name,
+				task->period, task->stats.average_time,
+				task->stats.max_time, task->stats.max_late,
+				task->stats.overruns);
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ * sched.h
+ *
+ * Cooperative scheduler for the main loop. Each part of the game registers
+ * a task - a function to call - and starts it with a delay. sched_think()
+ * reads the time once and calls only the tasks that are due, instead of
+ * every part polling the clock (with interrupts off) on every pass.
+ *
+ * Waiting tasks are kept in a timer wheel: SCHED_WHEEL_SLOTS lists, one
+ * per millisecond, with each task in the list for its deadline modulo
+ * SCHED_WHEEL_SLOTS. Each millisecond that passes only looks at one list,
+ * and a task due further ahead than one turn of the wheel is just passed
+ * over until its deadline comes round.
+ */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// Most tasks that can be registered (project.c registers nine)
+#define SCHED_MAX_TASKS		(9)
+
+// Slots in the timer wheel (a power of two)
+#define SCHED_WHEEL_SLOTS	(16)
+
+// Returned by sched_add() if there is no room for another task
+#define SCHED_NO_TASK		(0xFF)
+
+// Empty the wheel and forget any tasks. This must be called before tasks
+// are added.
+void init_sched(void);
+
+// Register a task. It isn't run until it is started. Tasks with a period
+// are run every period ms after that, keeping to the same phase; tasks
+// with a period of 0 are run once and can start themselves again. name
+// (in program memory) is used by sched_print_stats(). Returns the task
+// number.
+uint8_t sched_add(void (*function)(void), uint16_t period, PGM_P name);
+
+// Run the task delay ms from now (or the next millisecond if delay is 0).
+// A task that is already waiting is moved to the new time.
+void sched_start(uint8_t task, uint16_t delay);
+
+// Stop the task running until it is started again. A task can stop itself.
+void sched_stop(uint8_t task);
+
+// Return the ms until the task is due, or 0 if it isn't waiting
+uint16_t sched_time_left(uint8_t task);
+
+// Run the tasks that are due, in order of their deadlines. Each is run at
+// most once per call. This should be called frequently from the main loop.
+void sched_think(void);
+
+// The time sched_think() read, for use by tasks instead of
+// get_current_time()
+uint32_t sched_now(void);
+
+// A task is late when it is run after its deadline, and it overruns when a
+// periodic task is a whole period late (so a run is missed). An overrun
+// task starts again a period from when it was run. The average is over
+// roughly the last SCHED_AVERAGE_RUNS runs; the rest are since the task was
+// registered.
+#define SCHED_AVERAGE_RUNS	(8)
+struct sched_task_stats {
+	uint16_t average_time;	// us spent in the task
+	uint16_t max_time;		// us
+	uint16_t max_late;		// ms
+	uint16_t overruns;
+};
+
+void sched_get_stats(uint8_t task, struct sched_task_stats* stats);
+
+// Print the statistics of every task to the terminal (from row
+// SCHED_STATS_ROW, one row per task after a heading). This is below the
+// event log pane, clear of the baud rate table and the other statistics.
+#define SCHED_STATS_ROW		(43)
+void sched_print_stats(void);
+
+#endif /* SCHED_H_ */
@@ -12,12 +12,29 @@
  * put method will either
  * (1) if interrupts are enabled, block until there is room in it, or
  * (2) if interrupts are disabled, will discard the character.
+ * The game loop can instead ask for output that doesn't fit to be
+ * dropped (see serial_set_output_policy()), or send messages that a
+ * newer one replaces if it hasn't gone yet (see serial_write_keyed()).
  * Input is blocking - requesting input from stdin will block
  * until a character is available. If interrupts are disabled when 
  * input is sought, then this will block forever.
  * The function input_available() can be used to test whether there is
  * input available to read from stdin.
  *
+ * Output goes in one of two lanes. The HUD lane holds the keyed messages
+ * (see serial_write_keyed()) and everything else goes in the bulk lane.
+ * The UART sends from the HUD lane first, so a score or pause message
+ * doesn't wait behind a long stats dump or telemetry. To keep the
+ * terminal happy it only switches lanes between escape sequences and
+ * telemetry frames, and HUD messages save and restore the cursor and
+ * attributes around themselves.
+ *
+ * All the buffers are single producer, single consumer rings: the main loop
+ * only ever moves the head of the output ring and the tail of the input
+ * ring, and the ISRs only move the others. Each index is a single byte,
+ * so it is written atomically, and the main loop never has to turn
+ * interrupts off to add or remove a character.
+ *
  */
 
 #include "serialio.h"
@@ -25,37 +42,93 @@
 #include <stdint.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <ctype.h>
+#include <stdlib.h>
 
 /* System clock rate in Hz. (L at the end indicates this is a long constant) */
 #define SYSCLK 8000000L
 
 /* Global variables */
-/* Circular buffer to hold outgoing characters. The insert_pos variable
- * keeps track of the position (0 to OUTPUT_BUFFER_SIZE-1) that the next
- * outgoing character should be written to. bytes_in_buffer keeps
- * count of the number of characters currently stored in the buffer 
- * (ranging from 0 to OUTPUT_BUFFER_SIZE). This number of bytes immediately
- * prior to the current insert_pos are the bytes waiting to be output.
- * If the insert_pos reaches the end of the buffer it will wrap around
- * to the beginning (assuming those bytes have been output).
- * NOTE - OUTPUT_BUFFER_SIZE can not be larger than 255 without changing
- * the type of the variables below (currently defined as 8 bit unsigned ints).
+/* Circular buffer to hold outgoing characters. out_head is the position
+ * (0 to OUTPUT_BUFFER_SIZE-1) that the next outgoing character will be
+ * written to and is only changed by uart_put_char() and serial_write().
+ * out_tail is the position of the next character to be sent and is only
+ * changed by the UART data register empty ISR. The buffer is empty when
+ * the two are equal. One slot is always left unused so that a full
+ * buffer can be told apart from an empty one.
+ * NOTE - OUTPUT_BUFFER_SIZE must be a power of two so that we can wrap
+ * the positions with a mask, and can not be larger than 256 without
+ * changing the type of the variables below.
  */
-#define OUTPUT_BUFFER_SIZE 255
+#define OUTPUT_BUFFER_SIZE 256
+#define OUTPUT_BUFFER_MASK (OUTPUT_BUFFER_SIZE - 1)
 volatile char out_buffer[OUTPUT_BUFFER_SIZE];
-volatile uint8_t out_insert_pos;
-volatile uint8_t bytes_in_out_buffer;
+volatile uint8_t out_head;
+volatile uint8_t out_tail;
+
+/* The HUD lane. Works on the same principle as the output buffer above
+ * (the bulk lane). It only ever holds whole messages, so it must have room
+ * for the longest keyed message and its wrapping (see write_hud()) - 32
+ * would be too small.
+ */
+#define HUD_BUFFER_SIZE 64
+#define HUD_BUFFER_MASK (HUD_BUFFER_SIZE - 1)
+volatile char hud_buffer[HUD_BUFFER_SIZE];
+volatile uint8_t hud_head;
+volatile uint8_t hud_tail;
+
+/* What the last character sent from the bulk lane was part of. The ISR
+ * only sends from the HUD lane when this is BULK_TEXT. (Terminal text
+ * never contains a zero, and telemetry frames start and end with one.)
+ */
+#define BULK_TEXT		0
+#define BULK_ESCAPE		1	/* ESC received */
+#define BULK_CSI		2	/* ESC [ received, waiting for the final byte */
+#define BULK_FRAME		3	/* inside a telemetry frame */
+static uint8_t bulk_state;
+
+/* Count of all characters placed in the output buffer. Only changed by
+ * the producer so it can be read without disabling interrupts.
+ */
+static uint32_t bytes_output;
 
-/* Circular buffer to hold incoming characters. Works on same principle
- * as output buffer
+/* Circular buffer to hold incoming characters. Works on the same
+ * principle as the output buffer, except that the receive ISR moves the
+ * head and uart_get_char() moves the tail.
  */
-#define INPUT_BUFFER_SIZE 16
+#define INPUT_BUFFER_SIZE 64
+#define INPUT_BUFFER_MASK (INPUT_BUFFER_SIZE - 1)
 volatile char input_buffer[INPUT_BUFFER_SIZE];
-volatile uint8_t input_insert_pos;
-volatile uint8_t bytes_in_input_buffer;
+volatile uint8_t input_head;
+volatile uint8_t input_tail;
 volatile uint8_t input_overrun;
 
+/* What uart_put_char() and serial_write() do when the buffer is full */
+static uint8_t output_policy;
+
+/* Keyed messages waiting for room in the output buffer. A length of 0
+ * means nothing is held for that key. These are only used from the main
+ * loop.
+ */
+static char keyed_message[SERIAL_NUM_KEYS][SERIAL_KEYED_MAX];
+static uint8_t keyed_length[SERIAL_NUM_KEYS];
+
+static struct serial_output_stats output_stats;
+
+/* Called with everything added to the bulk lane */
+static void (*output_hook)(const char* data, uint8_t length);
+
+#if (OUTPUT_BUFFER_SIZE & OUTPUT_BUFFER_MASK) || OUTPUT_BUFFER_SIZE > 256
+#error "OUTPUT_BUFFER_SIZE must be a power of two no larger than 256"
+#endif
+#if (HUD_BUFFER_SIZE & HUD_BUFFER_MASK) || HUD_BUFFER_SIZE > 256
+#error "HUD_BUFFER_SIZE must be a power of two no larger than 256"
+#endif
+#if (INPUT_BUFFER_SIZE & INPUT_BUFFER_MASK) || INPUT_BUFFER_SIZE > 256
+#error "INPUT_BUFFER_SIZE must be a power of two no larger than 256"
+#endif
+
 /* Variable to keep track of whether incoming characters are to be echoed
  * back or not.
  */
@@ -72,16 +145,87 @@ static int uart_get_char(FILE*);
  */
 static FILE myStream = FDEV_SETUP_STREAM(uart_put_char, uart_get_char,_FDEV_SETUP_RW);
 
-void init_serial_stdio(long baudrate, int8_t echo) {
+/* The baud rate the UART is set to (as asked for, not as achieved) */
+static uint32_t current_baud;
+
+/* Standard rates offered by serial_baud_rate(), slowest first */
+static const uint32_t BAUD_RATES[SERIAL_NUM_BAUD_RATES] PROGMEM = {
+	9600, 19200, 38400, 57600, 76800, 115200, 250000, 500000
+};
+
+/* Work out the UBRR value which gives the rate nearest to baudrate when
+ * the UART divides the clock by divisor (16 normally, or 8 in double
+ * speed mode). Returns the error of that rate in tenths of a percent.
+ * (We add half the divisor before dividing so that we round to the
+ * nearest integer rather than truncate.)
+ */
+static int16_t baud_setting(uint32_t baudrate, uint8_t divisor,
+		uint16_t* ubrr) {
+	uint32_t setting = (SYSCLK + baudrate * divisor / 2) /
+			(baudrate * divisor);
+	if (setting == 0) {
+		setting = 1;
+	} else if (setting > 4096) {
+		setting = 4096;
+	}
+	*ubrr = setting - 1;
+	int32_t actual = SYSCLK / (divisor * setting);
+	return ((actual - (int32_t)baudrate) * 1000) / (int32_t)baudrate;
+}
+
+/* Pick normal or double speed mode, whichever is closer to baudrate.
+ * Normal mode wins a tie as its receiver samples each bit more times.
+ */
+static int16_t best_baud_setting(uint32_t baudrate, uint8_t* double_speed,
+		uint16_t* ubrr) {
+	uint16_t ubrr_2x;
+	int16_t error = baud_setting(baudrate, 16, ubrr);
+	int16_t error_2x = baud_setting(baudrate, 8, &ubrr_2x);
+	*double_speed = 0;
+	if (abs(error_2x) < abs(error)) {
+		*double_speed = 1;
+		*ubrr = ubrr_2x;
+		return error_2x;
+	}
+	return error;
+}
+
+/* Configure the serial port baud rate */
+static void set_baud(uint32_t baudrate) {
+	uint8_t double_speed;
 	uint16_t ubrr;
+	best_baud_setting(baudrate, &double_speed, &ubrr);
+	UBRR0 = ubrr;
+	if (double_speed) {
+		UCSR0A |= (1 << U2X0);
+	} else {
+		UCSR0A &= ~(1 << U2X0);
+	}
+	current_baud = baudrate;
+}
+
+void init_serial_stdio(long baudrate, int8_t echo) {
 	/*
 	 * Initialise our buffers
 	*/
-	out_insert_pos = 0;
-	bytes_in_out_buffer = 0;
-	input_insert_pos = 0;
-	bytes_in_input_buffer = 0;
+	out_head = 0;
+	out_tail = 0;
+	hud_head = 0;
+	hud_tail = 0;
+	bulk_state = BULK_TEXT;
+	input_head = 0;
+	input_tail = 0;
 	input_overrun = 0;
+	output_policy = SERIAL_BLOCK;
+	for (uint8_t key = 0; key < SERIAL_NUM_KEYS; key++) {
+		keyed_length[key] = 0;
+	}
+	for (uint8_t lane = 0; lane < SERIAL_NUM_LANES; lane++) {
+		output_stats.lanes[lane].max_used = 0;
+		output_stats.lanes[lane].dropped_writes = 0;
+		output_stats.lanes[lane].dropped_chars = 0;
+	}
+	output_stats.coalesced = 0;
 	
 	/*
 	 * Record whether we're going to echo characters or not
@@ -89,12 +233,7 @@ void init_serial_stdio(long baudrate, int8_t echo) {
 	do_echo = echo;
 	
 	/* Configure the serial port baud rate */
-	/* (This differs from the datasheet formula so that we get 
-	 * rounding to the nearest integer while using integer division
-	 * (which truncates)).
-	*/
-	ubrr = (((SYSCLK / (8 * baudrate)) + 1) / 2) - 1;
-	UBRR0 = ubrr;
+	set_baud(baudrate);
 	
 	/*
 	 * Enable transmission and receiving via UART. We don't enable
@@ -119,7 +258,7 @@ void init_serial_stdio(long baudrate, int8_t echo) {
 }
 
 int8_t serial_input_available(void) {
-	return bytes_in_input_buffer != 0;
+	return input_head != input_tail;
 }
 
 char get_serial_input(void) {
@@ -130,15 +269,88 @@ char get_serial_input(void) {
 	return serial_input;
 }
 
+uint32_t serial_baud_rate(uint8_t index) {
+	return pgm_read_dword(&BAUD_RATES[index]);
+}
+
+int16_t serial_baud_error(uint32_t baudrate, uint8_t* double_speed) {
+	uint16_t ubrr;
+	return best_baud_setting(baudrate, double_speed, &ubrr);
+}
+
+int8_t serial_set_baud(uint32_t baudrate) {
+	uint8_t double_speed;
+	if (abs(serial_baud_error(baudrate, &double_speed)) >
+			SERIAL_MAX_BAUD_ERROR) {
+		return -1;
+	}
+	/* Let everything already buffered go out at the old rate. TXC0 is
+	 * cleared as each byte is loaded, so once the buffer is empty it is
+	 * set when the last byte has left the shift register. (If
+	 * interrupts are off the buffer can't empty, so we just switch. If
+	 * nothing has been sent TXC0 will never be set.)
+	 */
+	if (bit_is_set(SREG, SREG_I) && bytes_output) {
+		while (out_head != out_tail || hud_head != hud_tail) {
+			/* do nothing */
+		}
+		while (!(UCSR0A & (1 << TXC0)) || !(UCSR0A & (1 << UDRE0))) {
+			/* do nothing */
+		}
+	}
+	set_baud(baudrate);
+	return 0;
+}
+
+uint32_t serial_get_baud(void) {
+	return current_baud;
+}
+
+uint32_t serial_bytes_output(void) {
+	return bytes_output;
+}
+
 void clear_serial_input_buffer(void) {
-	/* Just adjust our buffer data so it looks empty */
-	input_insert_pos = 0;
-	bytes_in_input_buffer = 0;
+	/* Just move the tail up to the head so the buffer looks empty. (Only
+	 * the consumer may change the tail.)
+	 */
+	input_tail = input_head;
+}
+
+/* Make sure the UART Data Register Empty interrupt is enabled so that it
+ * will fire and deal with the characters we've just added. The ISR may
+ * clear the bit between our read and write of UCSR0B, but only when it
+ * has found the buffer empty, i.e. before our new head was published -
+ * so setting it again here is always right.
+ */
+static void start_output(void) {
+	UCSR0B |= (1 << UDRIE0);
+}
+
+uint8_t serial_output_space(void) {
+	return (out_tail - out_head - 1) & OUTPUT_BUFFER_MASK;
+}
+
+static uint8_t hud_space(void) {
+	return (hud_tail - hud_head - 1) & HUD_BUFFER_MASK;
+}
+
+/* Update the high water marks */
+static void note_bulk_used(void) {
+	uint8_t used = OUTPUT_BUFFER_MASK - serial_output_space();
+	if (used > output_stats.lanes[SERIAL_LANE_BULK].max_used) {
+		output_stats.lanes[SERIAL_LANE_BULK].max_used = used;
+	}
+}
+
+static void note_hud_used(void) {
+	uint8_t used = HUD_BUFFER_MASK - hud_space();
+	if (used > output_stats.lanes[SERIAL_LANE_HUD].max_used) {
+		output_stats.lanes[SERIAL_LANE_HUD].max_used = used;
+	}
 }
 
 static int uart_put_char(char c, FILE* stream) {
-	uint8_t interrupts_enabled;
-	
 	/* Add the character to the buffer for transmission (if there 
 	 * is space to do so). If not we wait until the buffer has space.
 	 * If the character is \n, we output \r (carriage return)
@@ -152,72 +364,198 @@ static int uart_put_char(char c, FILE* stream) {
 	 * abort - we don't output the character since the buffer will
 	 * never be emptied if interrupts are disabled. If the buffer is full
 	 * and interrupts are enabled then we loop until the buffer has 
-	 * enough space. The bytes_in_buffer variable will get modified by the
-	 * ISR which extracts bytes from the buffer.
+	 * space. The out_tail variable will get modified by the ISR which
+	 * extracts bytes from the buffer.
 	*/
-	interrupts_enabled = bit_is_set(SREG, SREG_I);
-	while (bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE) {
-		if (!interrupts_enabled) {
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	uint8_t head = out_head;
+	uint8_t next = (head + 1) & OUTPUT_BUFFER_MASK;
+	while (next == out_tail) {
+		if (!interrupts_enabled || output_policy == SERIAL_DROP) {
+			output_stats.lanes[SERIAL_LANE_BULK].dropped_chars++;
 			return 1;
 		}		
 		/* else do nothing */
 	}
 	
-	/* Add the character to the buffer for transmission if there
-	 * is space to do so. We advance the insert_pos to the next
-	 * character position. If this is beyond the end of the buffer
-	 * we wrap around back to the beginning of the buffer 
-	 * NOTE: we disable interrupts before modifying the buffer. This
-	 * prevents the ISR from modifying the buffer at the same time.
-	 * We reenable them if they were enabled when we entered the
-	 * function.
+	/* Store the character, then publish it by advancing the head. The
+	 * ISR never looks at a slot until the head has moved past it.
 	*/	
-	cli();
-	out_buffer[out_insert_pos++] = c;
-	bytes_in_out_buffer++;
-	if (out_insert_pos == OUTPUT_BUFFER_SIZE) {
-		/* Wrap around buffer pointer if necessary */
-		out_insert_pos = 0;
-	}
-	/* Reenable interrupts (UDR Empty interrupt may have been
-	 * disabled) - we ensure it is now enabled so that it will
-	 * fire and deal with the next character in the buffer. */
-	UCSR0B |= (1 << UDRIE0);
-	if (interrupts_enabled) {
-		sei();
+	out_buffer[head] = c;
+	out_head = next;
+	bytes_output++;
+	note_bulk_used();
+	start_output();
+	if (output_hook) {
+		output_hook(&c, 1);
 	}
 	return 0;
 }
 
+/* Add length characters to the bulk lane, which must have room */
+static void write_now(const char* data, uint8_t length) {
+	uint8_t head = out_head;
+	bytes_output += length;
+	for (uint8_t i = 0; i < length; i++) {
+		out_buffer[head] = data[i];
+		head = (head + 1) & OUTPUT_BUFFER_MASK;
+	}
+	out_head = head;
+	note_bulk_used();
+	start_output();
+	if (output_hook) {
+		output_hook(data, length);
+	}
+}
+
+/* Add a keyed message to the HUD lane, which must have room for it and
+ * HUD_WRAP_LENGTH more. The message is wrapped in escape sequences that
+ * save and restore the cursor position and attributes, so that it can be
+ * sent in the middle of other output without upsetting it. The HUD lane
+ * can be sent straight after a bulk lane attribute change (e.g. a
+ * termboard colour), so the attributes are reset once they are saved.
+ */
+#define HUD_WRAP_LENGTH 8	/* ESC 7 ESC [ 0 m before, ESC 8 after */
+#if SERIAL_KEYED_MAX + HUD_WRAP_LENGTH > HUD_BUFFER_MASK
+#error "The HUD lane must have room for the longest keyed message"
+#endif
+static void write_hud(const char* data, uint8_t length) {
+	uint8_t head = hud_head;
+	bytes_output += length + HUD_WRAP_LENGTH;
+	hud_buffer[head] = '\x1b';
+	head = (head + 1) & HUD_BUFFER_MASK;
+	hud_buffer[head] = '7';
+	head = (head + 1) & HUD_BUFFER_MASK;
+	hud_buffer[head] = '\x1b';
+	head = (head + 1) & HUD_BUFFER_MASK;
+	hud_buffer[head] = '[';
+	head = (head + 1) & HUD_BUFFER_MASK;
+	hud_buffer[head] = '0';
+	head = (head + 1) & HUD_BUFFER_MASK;
+	hud_buffer[head] = 'm';
+	head = (head + 1) & HUD_BUFFER_MASK;
+	while (length--) {
+		hud_buffer[head] = *data++;
+		head = (head + 1) & HUD_BUFFER_MASK;
+	}
+	hud_buffer[head] = '\x1b';
+	head = (head + 1) & HUD_BUFFER_MASK;
+	hud_buffer[head] = '8';
+	head = (head + 1) & HUD_BUFFER_MASK;
+	hud_head = head;
+	note_hud_used();
+	start_output();
+}
+
+void serial_write(const char* data, uint8_t length) {
+	if (output_policy == SERIAL_DROP && length > serial_output_space()) {
+		output_stats.lanes[SERIAL_LANE_BULK].dropped_writes++;
+		output_stats.lanes[SERIAL_LANE_BULK].dropped_chars += length;
+		return;
+	}
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	while (length) {
+		/* Wait for space as uart_put_char() does, or give up if the
+		 * buffer can never be emptied.
+		 */
+		uint8_t space;
+		while ((space = serial_output_space()) == 0) {
+			if (!interrupts_enabled) {
+				return;
+			}
+		}
+		
+		/* Copy as much as fits in one go and publish it all at once */
+		uint8_t count = (length < space) ? length : space;
+		write_now(data, count);
+		data += count;
+		length -= count;
+	}
+}
+
+void serial_write_P(const char* string) {
+	char buffer[16];
+	uint8_t length = 0;
+	char c;
+	while ((c = pgm_read_byte(string++))) {
+		buffer[length++] = c;
+		if (length == sizeof(buffer)) {
+			serial_write(buffer, length);
+			length = 0;
+		}
+	}
+	serial_write(buffer, length);
+}
+
+uint8_t serial_set_output_policy(uint8_t policy) {
+	uint8_t previous = output_policy;
+	output_policy = policy;
+	return previous;
+}
+
+void serial_write_keyed(uint8_t key, const char* data, uint8_t length) {
+	if (length > SERIAL_KEYED_MAX) {
+		output_stats.lanes[SERIAL_LANE_HUD].dropped_writes++;
+		output_stats.lanes[SERIAL_LANE_HUD].dropped_chars += length;
+		return;
+	}
+	if (!keyed_length[key] && length + HUD_WRAP_LENGTH <= hud_space()) {
+		write_hud(data, length);
+		return;
+	}
+	/* Hold it (replacing any older message for this key) until there's
+	 * room
+	 */
+	if (keyed_length[key]) {
+		output_stats.coalesced++;
+	}
+	for (uint8_t i = 0; i < length; i++) {
+		keyed_message[key][i] = data[i];
+	}
+	keyed_length[key] = length;
+}
+
+void serial_output_think(void) {
+	for (uint8_t key = 0; key < SERIAL_NUM_KEYS; key++) {
+		uint8_t length = keyed_length[key];
+		if (length && length + HUD_WRAP_LENGTH <= hud_space()) {
+			write_hud(keyed_message[key], length);
+			keyed_length[key] = 0;
+		}
+	}
+}
+
+void serial_set_output_hook(void (*hook)(const char* data, uint8_t length)) {
+	output_hook = hook;
+}
+
+void serial_get_output_stats(struct serial_output_stats* stats) {
+	*stats = output_stats;
+	stats->lanes[SERIAL_LANE_HUD].used = HUD_BUFFER_MASK - hud_space();
+	stats->lanes[SERIAL_LANE_BULK].used =
+			OUTPUT_BUFFER_MASK - serial_output_space();
+}
+
 int uart_get_char(FILE* stream) {
 	/* Wait until we've received a character */
-	while (bytes_in_input_buffer == 0) {
+	while (input_head == input_tail) {
 		/* do nothing */
 	}
 	
 	/*
-	 * Turn interrupts off and remove a character from the input
-	 * buffer. We reenable interrupts if they were on.
-	 * The pending character is the one which is byte_in_input_buffer
-	 * characters before the insert position (taking into account
-	 * that we may need to wrap around).
+	 * Take the character at the tail and then move the tail on, which
+	 * hands the slot back to the receive ISR.
 	 */
-	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
-	cli();
-	char c;
-	if (input_insert_pos - bytes_in_input_buffer < 0) {
-		/* Need to wrap around */
-		c = input_buffer[input_insert_pos - bytes_in_input_buffer
-				+ INPUT_BUFFER_SIZE];
-	} else {
-		c = input_buffer[input_insert_pos - bytes_in_input_buffer];
-	}
+	uint8_t tail = input_tail;
+	char c = input_buffer[tail];
+	input_tail = (tail + 1) & INPUT_BUFFER_MASK;
 	
-	/* Decrement our count of bytes in the input buffer */
-	bytes_in_input_buffer--;
-	if (interrupts_enabled) {
-		sei();
-	}	
+	/* Echo from here rather than from the receive ISR so that the main
+	 * loop stays the only producer for the output buffer.
+	 */
+	if (do_echo) {
+		uart_put_char(c, stream);
+	}
 	return c;
 }
 
@@ -227,35 +565,57 @@ int uart_get_char(FILE* stream) {
  */
 ISR(USART0_UDRE_vect) 
 {
-	/* Check if we have data in our buffer */
-	if (bytes_in_out_buffer > 0) {
-		/* Yes we do - remove the pending byte and output it
-		 * via the UART. The pending byte (character) is the
-		 * one which is "bytes_in_buffer" characters before the 
-		 * insert_pos (taking into account that we may 
-		 * need to wrap around to the end of the buffer).
-		 */
-		char c;
-		if (out_insert_pos - bytes_in_out_buffer < 0) {
-			/* Need to wrap around */
-			c = out_buffer[out_insert_pos - bytes_in_out_buffer
-				+ OUTPUT_BUFFER_SIZE];
-		} else {
-			c = out_buffer[out_insert_pos - bytes_in_out_buffer];
-		}
-		/* Decrement our count of the number of bytes in the 
-		 * buffer 
-		 */
-		bytes_in_out_buffer--;
-		
-		/* Output the character via the UART */
+	/* Send from the HUD lane if it has anything and we're not part way
+	 * through an escape sequence or frame from the bulk lane. Otherwise
+	 * send from the bulk lane if it has anything. Either way we move the
+	 * tail on, which hands the slot back to the producer.
+	 */
+	uint8_t tail = hud_tail;
+	if (tail != hud_head && bulk_state == BULK_TEXT) {
+		// Clear TXC0 (see serial_set_baud()) by writing a 1 to it. A
+		// read-modify-write would also write back the other flags; only
+		// U2X0 must keep its value.
+		UCSR0A = (UCSR0A & (1 << U2X0)) | (1 << TXC0);
+		UDR0 = hud_buffer[tail];
+		hud_tail = (tail + 1) & HUD_BUFFER_MASK;
+		return;
+	}
+	tail = out_tail;
+	if (tail != out_head) {
+		char c = out_buffer[tail];
+		UCSR0A = (UCSR0A & (1 << U2X0)) | (1 << TXC0);
 		UDR0 = c;
+		out_tail = (tail + 1) & OUTPUT_BUFFER_MASK;
+		
+		/* Keep track of what we're in the middle of */
+		switch (bulk_state) {
+			case BULK_TEXT:
+				if (c == '\x1b') {
+					bulk_state = BULK_ESCAPE;
+				} else if (c == 0) {
+					bulk_state = BULK_FRAME;
+				}
+				break;
+			case BULK_ESCAPE:
+				bulk_state = (c == '[') ? BULK_CSI : BULK_TEXT;
+				break;
+			case BULK_CSI:
+				if (c >= 0x40 && c <= 0x7E) {
+					bulk_state = BULK_TEXT;
+				}
+				break;
+			default:
+				if (c == 0) {
+					bulk_state = BULK_TEXT;
+				}
+				break;
+		}
 	} else {
-		/* No data in the buffer. We disable the UART Data
-		 * Register Empty interrupt because otherwise it 
-		 * will trigger again immediately this ISR exits. 
-		 * The interrupt is reenabled when a character is
-		 * placed in the buffer.
+		/* No data in the buffer (or only HUD data which has to wait
+		 * for the rest of an escape sequence). We disable the UART
+		 * Data Register Empty interrupt because otherwise it will
+		 * trigger again immediately this ISR exits. The interrupt is
+		 * reenabled when a character is placed in either buffer.
 		 */
 		UCSR0B &= ~(1 << UDRIE0);
 	}
@@ -272,15 +632,6 @@ ISR(USART0_RX_vect)
 	/* Read the character - we ignore the possibility of overrun. */
 	char c;
 	c = UDR0;
-		
-	if (do_echo && bytes_in_out_buffer < OUTPUT_BUFFER_SIZE) {
-		/* If echoing is enabled and there is output buffer
-		 * space, echo the received character back to the UART.
-		 * (If there is no output buffer space, characters
-		 * will be lost.)
-		 */
-		uart_put_char(c, 0);
-	}
 	
 	/* 
 	 * Check if we have space in our buffer. If not, set the overrun
@@ -288,7 +639,9 @@ ISR(USART0_RX_vect)
 	 * overrun flag - it's up to the programmer to check/clear
 	 * this flag if desired.)
 	 */
-	if (bytes_in_input_buffer >= INPUT_BUFFER_SIZE) {
+	uint8_t head = input_head;
+	uint8_t next = (head + 1) & INPUT_BUFFER_MASK;
+	if (next == input_tail) {
 		input_overrun = 1;
 	} else {
 		/* If the character is a carriage return, turn it into a
@@ -299,14 +652,11 @@ ISR(USART0_RX_vect)
 		}
 		
 		/* 
-		 * There is room in the input buffer 
+		 * There is room in the input buffer - store the character
+		 * and then publish it by moving the head on.
 		 */
-		input_buffer[input_insert_pos++] = c;
-		bytes_in_input_buffer++;
-		if (input_insert_pos == INPUT_BUFFER_SIZE) {
-			/* Wrap around buffer pointer if necessary */
-			input_insert_pos = 0;
-		}
+		input_buffer[head] = c;
+		input_head = next;
 	}
 }
 
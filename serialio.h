@@ -20,11 +20,37 @@
 
 /* Initialise serial IO using the UART. baudrate specifies the desired
  * baud rate (e.g. 19200) and echo determines whether incoming characters
- * are echoed back to the UART output as they are received (zero means no
+ * are echoed back to the UART output as they are read (zero means no
  * echo, non-zero means echo)
  */
 void init_serial_stdio(long baudrate, int8_t echo);
 
+/* Standard baud rates that serial_set_baud() can be given, for
+ * index 0 to SERIAL_NUM_BAUD_RATES-1 (slowest first). Not all of them
+ * can be produced accurately enough from our clock - check with
+ * serial_baud_error().
+ */
+#define SERIAL_NUM_BAUD_RATES	(8)
+uint32_t serial_baud_rate(uint8_t index);
+
+/* Return how far the nearest rate the UART can produce is from baudrate,
+ * in tenths of a percent (negative if slower), and set *double_speed to
+ * 1 if it needs the UART's double speed (U2X) mode. Rates more than
+ * SERIAL_MAX_BAUD_ERROR out are not reliable - the receiver has to stay
+ * within about half a bit over a whole frame, and the other end has its
+ * own error too.
+ */
+#define SERIAL_MAX_BAUD_ERROR	(20)
+int16_t serial_baud_error(uint32_t baudrate, uint8_t* double_speed);
+
+/* Change the baud rate, after waiting for any output already buffered to
+ * be sent at the old rate. Returns -1 (leaving the rate alone) if the
+ * rate can't be produced accurately enough, 0 otherwise.
+ * serial_get_baud() returns the rate last set.
+ */
+int8_t serial_set_baud(uint32_t baudrate);
+uint32_t serial_get_baud(void);
+
 /* Test if input is available from the serial port. Return 0 if not,
  * non-zero otherwise. If there is input available then it can be read
  * with a suitable standard IO library function, e.g. fgetc().
@@ -39,6 +65,76 @@ void clear_serial_input_buffer(void);
 
 char get_serial_input(void);
 
+/* Return the number of characters that have been written to the serial
+ * output buffer (including the carriage return added before each line
+ * feed). Subtract two values to find the bytes sent by some output.
+ */
+uint32_t serial_bytes_output(void);
+
+/* Add characters straight to the output buffer, without going through
+ * stdio. If the buffer fills up we wait, or (if interrupts are disabled)
+ * discard the rest, as for stdio output. Line feeds are not expanded to
+ * carriage return and line feed. serial_write_P() writes a string from
+ * program memory.
+ */
+void serial_write(const char* data, uint8_t length);
+void serial_write_P(const char* string);
+
+/* What to do when output doesn't fit in the output buffer. With
+ * SERIAL_BLOCK (the default) we wait for the UART to make room, as above.
+ * With SERIAL_DROP we never wait: a serial_write() that doesn't fit is
+ * thrown away whole and stdio output is thrown away character by
+ * character, and both are counted. serial_set_output_policy() returns the
+ * previous policy so that it can be restored.
+ */
+#define SERIAL_BLOCK	(0)
+#define SERIAL_DROP		(1)
+uint8_t serial_set_output_policy(uint8_t policy);
+
+/* Return the number of characters that can be added to the output buffer
+ * (the bulk lane) right now without waiting.
+ */
+uint8_t serial_output_space(void);
+
+/* Send a message that only matters until a newer one with the same key
+ * (0 to SERIAL_NUM_KEYS-1) replaces it, e.g. a score line. The message
+ * should be complete in itself (i.e. move the cursor first). If it can't
+ * be added to the output buffer straight away it is held, replacing any
+ * message already held for the key, and serial_output_think() sends it
+ * once there is room. This never waits, whatever the output policy.
+ */
+#define SERIAL_NUM_KEYS		(4)
+#define SERIAL_KEYED_MAX	(36)	// the speed line is the longest, at 35
+void serial_write_keyed(uint8_t key, const char* data, uint8_t length);
+void serial_output_think(void);
+
+/* Output is sent from two lanes, each with its own buffer. Keyed
+ * messages go in the HUD lane and are sent ahead of everything else,
+ * which goes in the bulk lane. The counts of output thrown away or
+ * replaced are since init_serial_stdio().
+ */
+#define SERIAL_LANE_HUD		(0)
+#define SERIAL_LANE_BULK	(1)
+#define SERIAL_NUM_LANES	(2)
+struct serial_lane_stats {
+	uint8_t used;				// characters waiting now
+	uint8_t max_used;
+	uint16_t dropped_writes;	// whole serial_write() or keyed messages
+	uint16_t dropped_chars;		// characters, including those in writes
+};
+struct serial_output_stats {
+	struct serial_lane_stats lanes[SERIAL_NUM_LANES];
+	uint16_t coalesced;			// held keyed messages replaced
+};
+void serial_get_output_stats(struct serial_output_stats* stats);
+
+/* Have hook called with everything added to the bulk lane (but not with
+ * output that was dropped). terminalio uses this to keep track of where
+ * the cursor is. Keyed messages restore the cursor after themselves, so
+ * they are not passed on.
+ */
+void serial_set_output_hook(void (*hook)(const char* data, uint8_t length));
+
 /////////////////////////////EXTRA FUNCTIONALITY////////////////////////////
 
 
@@ -56,5 +152,11 @@ char get_serial_input(void);
 
 int8_t start_input_pressed(void);
 
+// Keys for serial_write_keyed()
+#define SERIAL_KEY_SPEED	(0)
+#define SERIAL_KEY_PAUSE	(1)
+#define SERIAL_KEY_SCORE_1	(2)
+#define SERIAL_KEY_SCORE_2	(3)
+
 
 #endif /* SERIALIO_H_ */
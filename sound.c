@@ -13,9 +13,13 @@
 #include <avr/pgmspace.h>
 #include "tunes.h"
 #include "timer0.h"
+#include "flow.h"
+#include "spi.h"
 
-#define F_CPU 8000000UL
-#include <util/delay.h>
+// The alarm sweeps from ALARM_START_HZ to ALARM_END_HZ, going up 1 Hz
+// each ms
+#define ALARM_START_HZ	(100)
+#define ALARM_END_HZ	(1000)
 
 /*static uint16_t freq = 200; // Hz*/
 /*static float duty_cycle = 50; // %*/
@@ -29,6 +33,12 @@ uint16_t delay_ms = 0;
 
 static uint8_t mute = 0;
 
+// Alarm sweep (see Tunes_alert_alarm())
+static struct flow alarm_flow;
+static uint8_t alarm_running = 0;
+static uint8_t alarm_vuvuzela;
+static uint32_t alarm_start_time;
+
 // For a given frequency (Hz), return the clock period (in terms of the
 // number of clock cycles of a 1MHz clock)
 uint16_t freq_to_clock_period(uint16_t freq) {
@@ -94,10 +104,13 @@ void Tone(uint16_t tone, uint16_t duration_ms){
 }
 
 void Tunes_SetTimer(void){
-	// Make pin OC1B (D4) be an output
+#if SPI_TRANSPORT != SPI_TRANSPORT_USART1
+	// Make pin OC1B (D4) be an output. (With the USART1 transport D4 is the
+	// LED matrix clock, so the buzzer stays disconnected.)
 	DDRD |= (1<<4);
 
 	TCCR1A |= (1<<COM1B1);
+#endif
 	TCCR1B |= (1<<CS11);
 }
 
@@ -126,9 +139,12 @@ void Tunes_Stop(void){
 	OCR1B = 0;
 	TCNT1 = 0;
 	
+#if SPI_TRANSPORT != SPI_TRANSPORT_USART1
 	DDRD &= ~(1<<4);
+#endif
 	
 	tunes_playing = 0;
+	alarm_running = 0;
 }
 
 void Tunes_SetVolume(uint8_t volume){
@@ -141,23 +157,45 @@ char Tunes_IsPlaying(void){
 }
 
 void Tunes_alert_alarm(uint8_t vuvuzela){
-	uint16_t f;
-	
-	for(f = 100; f < 1000; f++){
-			_delay_ms(1);
-			
-			if(vuvuzela == 0) while(TCNT1 > 0);
-			
-			Tone(f, 0);
-			
-			if(vuvuzela) TCNT1 = 0;
+	if(mute) return;
+	alarm_vuvuzela = vuvuzela;
+	FLOW_RESET(&alarm_flow);
+	alarm_running = 1;
+	tunes_playing = 1;
+}
+
+// One step of the alarm sweep. The frequency comes from the time since the
+// start, so the sweep takes the same time however often we are called.
+static uint8_t alarm_step(struct flow* f){
+	FLOW_BEGIN(f);
+	alarm_start_time = sched_now();
+	while(sched_now() - alarm_start_time < ALARM_END_HZ - ALARM_START_HZ){
+		if(!alarm_vuvuzela && (TCCR1B & (1<<CS11))){
+			// Let the current cycle finish - timer 1 sets TOV1 at the
+			// bottom of each cycle. There is no cycle to finish if the
+			// timer is stopped (before the first tone), and TOV1 would
+			// never be set.
+			TIFR1 = (1<<TOV1);
+			FLOW_WAIT_UNTIL(f, TIFR1 & (1<<TOV1));
+		}
+		
+		Tone(ALARM_START_HZ + (sched_now() - alarm_start_time), 0);
+		
+		if(alarm_vuvuzela) TCNT1 = 0;
+		FLOW_YIELD(f);
 	}
 	
 	Tunes_Stop();
+	FLOW_END(f);
 }
 
 void Tunes_Think(void){
 	if(mute) return;
+	
+	if(alarm_running){
+		if(alarm_step(&alarm_flow) == FLOW_DONE) alarm_running = 0;
+		return;
+	}
 	static int16_t duration = 0;
 	uint16_t note = 0;
 	
@@ -29,6 +29,8 @@ void Tunes_SetVolume(uint8_t volume);
 char Tunes_IsPlaying(void);
 void Tunes_Think(void);
 void Tunes_Play_Mario(void);
+// Start a rising alarm (about 900 ms) in place of any song. It is played
+// by Tunes_Think(), like a song.
 void Tunes_alert_alarm(uint8_t vuvuzela);
 void Tunes_Play_star(void);
 void toggle_mute(void);
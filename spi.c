@@ -6,6 +6,111 @@
 
 #include "spi.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define SPI_TX_BUFFER_MASK (SPI_TX_BUFFER_SIZE - 1)
+
+/* Circular buffer of bytes waiting to be sent. tx_head is where the next
+ * byte will be inserted and tx_tail is the next byte to be sent. Both count
+ * up forever (wrapping at 256) and are masked when indexing the buffer, so
+ * the number of bytes waiting is always tx_head - tx_tail. tx_busy is 1
+ * while a byte is being shifted out or a pause is in progress. A bit is set
+ * in tx_control for each entry that is a control entry rather than a byte
+ * to send - either a slave number (see spi_enqueue_select()) or, if
+ * CONTROL_PAUSE is set, a pause length (see spi_enqueue_pause()).
+ */
+static volatile uint8_t tx_buffer[SPI_TX_BUFFER_SIZE];
+static volatile uint8_t tx_control[SPI_TX_BUFFER_SIZE / 8];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+static volatile uint8_t tx_busy;
+static uint8_t tx_high_water;
+static volatile uint8_t tx_pausing;
+
+#define CONTROL_PAUSE 0x80
+
+// Number of slave select lines in use
+static uint8_t num_slaves = 1;
+
+static void spi_select(uint8_t slave);
+static void spi_start_pause(uint8_t fine_ticks);
+static void spi_queue_entry(uint8_t value, uint8_t is_control);
+static void spi_start_byte(uint8_t byte);
+static void spi_transmit_next(void);
+static void spi_poll_transfer(void);
+static void spi_poll_byte(void);
+
+#define ENTRY_IS_CONTROL(index) (tx_control[(index) / 8] & (1 << ((index) % 8)))
+
+#if SPI_TRANSPORT == SPI_TRANSPORT_USART1
+
+void spi_setup_master(uint8_t clockdivider) {
+	// Set up USART1 as an SPI master (MSPIM). The clock (XCK1) and data
+	// out (TXD1) pins are pins 4 and 3 of port D. The slave select line
+	// is still pin 4 of port B. The LED matrix sends nothing back, so the
+	// receiver is left off and pin 2 of port D (RXD1) stays free for the
+	// seven segment display.
+	DDRD |= (1 << DDD4) | (1 << DDD3);
+	DDRB |= (1 << DDB4);
+	
+	// Set the slave select (SS) line high
+	PORTB |= (1 << PORTB4);
+	
+	// Empty the transmit queue
+	tx_head = 0;
+	tx_tail = 0;
+	tx_busy = 0;
+	tx_pausing = 0;
+	tx_high_water = 0;
+	num_slaves = 1;
+	
+	// The baud rate register must be zero while the transmitter is
+	// enabled. UMSEL1 = 11 selects master SPI mode and UCPHA1 = UCPOL1 = 0
+	// and UDORD1 = 0 give SPI mode 0, MSB first, as used on SPI0.
+	UBRR1 = 0;
+	UCSR1C = (1 << UMSEL11) | (1 << UMSEL10);
+	UCSR1B = (1 << TXEN1);
+	spi_set_clock_divider(clockdivider);
+	
+	// Take SS (slave select) line low
+	PORTB &= ~(1 << PORTB4);
+}
+
+void spi_set_clock_divider(uint8_t clockdivider) {
+	spi_flush();
+	
+	// Only the invalid divider values (which default to the slowest speed)
+	// need checking - the rest give a baud rate of F_CPU / clockdivider.
+	switch (clockdivider) {
+		case 2: /* FALLTHROUGH */
+		case 4: /* FALLTHROUGH */
+		case 8: /* FALLTHROUGH */
+		case 16: /* FALLTHROUGH */
+		case 32: /* FALLTHROUGH */
+		case 64:
+			break;
+		default:
+			clockdivider = 128;
+			break;
+	}
+	UBRR1 = clockdivider / 2 - 1;
+}
+
+uint8_t spi_send_byte(uint8_t byte) {
+	// Make sure queued bytes go out first
+	spi_flush();
+	
+	// The receiver is off, so wait for transmit complete (cleared by
+	// writing a 1 to it) instead of a received byte
+	UCSR1A = (1 << TXC1);
+	UDR1 = byte;
+	while ((UCSR1A & (1 << TXC1)) == 0) {
+		; // wait
+	}
+	return 0;
+}
+
+#else
 
 void spi_setup_master(uint8_t clockdivider) {
 	// Set up SPI communication as a master
@@ -19,7 +124,26 @@ void spi_setup_master(uint8_t clockdivider) {
 	// Set up the SPI control registers SPCR and SPSR:
 	// - SPE bit = 1 (SPI is enabled)
 	// - MSTR bit = 1 (Master Mode)
-	SPCR0 = (1 << SPE0) | (1 << MSTR0);
+	// - SPIE bit = 1 (Interrupt on transfer complete)
+	SPCR0 = (1 << SPE0) | (1 << MSTR0) | (1 << SPIE0);
+	
+	// Empty the transmit queue
+	tx_head = 0;
+	tx_tail = 0;
+	tx_busy = 0;
+	tx_pausing = 0;
+	tx_high_water = 0;
+	num_slaves = 1;
+	
+	spi_set_clock_divider(clockdivider);
+	
+	// Take SS (slave select) line low
+	PORTB &= ~(1 << PORTB4);
+}
+
+void spi_set_clock_divider(uint8_t clockdivider) {
+	spi_flush();
+	SPCR0 &= ~((1 << SPR10) | (1 << SPR00));
 	
 	// Set SPR0 and SPR1 bits in SPCR and SPI2X bit in SPSR
 	// based on the given clock divider
@@ -48,12 +172,16 @@ void spi_setup_master(uint8_t clockdivider) {
 			SPCR0 |= (1 << SPR00);
 			break;
 	}
-	
-	// Take SS (slave select) line low
-	PORTB &= ~(1 << PORTB4);
 }
 
 uint8_t spi_send_byte(uint8_t byte) {
+	uint8_t received;
+	
+	// Make sure queued bytes go out first, then turn off the transfer
+	// complete interrupt so that it doesn't clear SPIF0 before we see it
+	spi_flush();
+	SPCR0 &= ~(1 << SPIE0);
+	
 	// Write out the byte to the SPDR0 register. This will initiate
 	// the transfer. We then wait until the most significant byte of
 	// SPSR0 (SPIF0 bit) is set - this indicates that the transfer is
@@ -64,5 +192,262 @@ uint8_t spi_send_byte(uint8_t byte) {
 	while ((SPSR0 & (1 << SPIF0)) == 0) {
 		; // wait
 	}
-	return SPDR0;
+	received = SPDR0;
+	SPCR0 |= (1 << SPIE0);
+	return received;
+}
+
+#endif /* SPI_TRANSPORT */
+
+void spi_enqueue(uint8_t byte) {
+	spi_queue_entry(byte, 0);
+}
+
+void spi_setup_slaves(uint8_t num_slaves_in) {
+	if (num_slaves_in == 0 || num_slaves_in > SPI_MAX_SLAVES) {
+		return;
+	}
+	spi_flush();
+	num_slaves = num_slaves_in;
+	// Drive each select line high (not selected) before making it an
+	// output, so that no panel is selected in between
+	for (uint8_t slave = 1; slave < num_slaves; slave++) {
+		PORTA |= (1 << (8 - slave));
+		DDRA |= (1 << (8 - slave));
+	}
+	spi_select(0);
+}
+
+void spi_enqueue_select(uint8_t slave) {
+	if (slave >= num_slaves) {
+		return;
+	}
+	spi_queue_entry(slave, 1);
+}
+
+void spi_enqueue_pause(uint8_t fine_ticks) {
+	// Timer 0 must be running for the pause to end
+	uint8_t timer_running = TCCR0B & ((1 << CS02) | (1 << CS01) | (1 << CS00));
+	if (fine_ticks == 0 || !timer_running) {
+		return;
+	}
+	if (fine_ticks < SPI_MIN_PAUSE) {
+		fine_ticks = SPI_MIN_PAUSE;
+	} else if (fine_ticks > SPI_MAX_PAUSE) {
+		fine_ticks = SPI_MAX_PAUSE;
+	}
+	spi_queue_entry(CONTROL_PAUSE | fine_ticks, 1);
+}
+
+void spi_flush(void) {
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	while (tx_busy) {
+		if (!interrupts_enabled) {
+			spi_poll_transfer();
+		}
+	}
+}
+
+uint8_t spi_tx_high_water_mark(void) {
+	return tx_high_water;
+}
+
+// Take the select line of the given slave low and those of the other
+// slaves high. Must only be called while no byte is being sent.
+static void spi_select(uint8_t slave) {
+	PORTB |= (1 << PORTB4);
+	for (uint8_t i = 1; i < num_slaves; i++) {
+		PORTA |= (1 << (8 - i));
+	}
+	if (slave == 0) {
+		PORTB &= ~(1 << PORTB4);
+	} else {
+		PORTA &= ~(1 << (8 - slave));
+	}
+}
+
+// Start a pause of the given number of timer 0 ticks. Timer 0 counts from
+// 0 to OCR0A (see timer0.c), so we set compare match B to go off the given
+// number of ticks from now. Must be called with interrupts disabled.
+static void spi_start_pause(uint8_t fine_ticks) {
+	uint8_t match = TCNT0 + fine_ticks;
+	if (match > OCR0A) {
+		match -= OCR0A + 1;
+	}
+	OCR0B = match;
+	tx_pausing = 1;
+	TIFR0 = (1 << OCF0B);
+	TIMSK0 |= (1 << OCIE0B);
+}
+
+// Add a byte or a control entry to the transmit queue, waiting for space if
+// the queue is full.
+static void spi_queue_entry(uint8_t value, uint8_t is_control) {
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	
+	// If the queue is full we wait for the interrupt handler to make space.
+	// If interrupts are disabled it never will, so we send a byte ourselves.
+	while ((uint8_t)(tx_head - tx_tail) >= SPI_TX_BUFFER_SIZE) {
+		if (!interrupts_enabled) {
+			spi_poll_transfer();
+		}
+	}
+	
+	cli();
+	if (!tx_busy) {
+		// Nothing is being sent - act on this entry straight away
+		if (is_control && (value & CONTROL_PAUSE)) {
+			tx_busy = 1;
+			spi_start_pause(value & ~CONTROL_PAUSE);
+		} else if (is_control) {
+			spi_select(value);
+		} else {
+			tx_busy = 1;
+			spi_start_byte(value);
+		}
+	} else {
+		uint8_t index = tx_head & SPI_TX_BUFFER_MASK;
+		tx_buffer[index] = value;
+		if (is_control) {
+			tx_control[index / 8] |= (1 << (index % 8));
+		} else {
+			tx_control[index / 8] &= ~(1 << (index % 8));
+		}
+		tx_head++;
+		if ((uint8_t)(tx_head - tx_tail) > tx_high_water) {
+			tx_high_water = tx_head - tx_tail;
+		}
+#if SPI_TRANSPORT == SPI_TRANSPORT_USART1
+		// The transmit buffer may have run dry - make sure the data
+		// register empty interrupt picks up the new entry (unless we are
+		// pausing, in which case the end of the pause will)
+		if (!tx_pausing) {
+			UCSR1B |= (1 << UDRIE1);
+		}
+#endif
+	}
+	if (interrupts_enabled) {
+		sei();
+	}
+}
+
+// Start sending the next queued byte, or mark the SPI as idle if the queue
+// is empty. Slave changes at the front of the queue are made first, and a
+// pause stops us until it is over. Must be called with interrupts disabled,
+// and only once the previous byte has been completely sent.
+static void spi_transmit_next(void) {
+	while (tx_head != tx_tail) {
+		uint8_t index = tx_tail & SPI_TX_BUFFER_MASK;
+		tx_tail++;
+		if (ENTRY_IS_CONTROL(index) && (tx_buffer[index] & CONTROL_PAUSE)) {
+			spi_start_pause(tx_buffer[index] & ~CONTROL_PAUSE);
+			return;
+		} else if (ENTRY_IS_CONTROL(index)) {
+			spi_select(tx_buffer[index]);
+		} else {
+			spi_start_byte(tx_buffer[index]);
+			return;
+		}
+	}
+	tx_busy = 0;
+}
+
+// Used instead of the interrupt handlers when interrupts are disabled.
+static void spi_poll_transfer(void) {
+	if (tx_pausing) {
+		while ((TIFR0 & (1 << OCF0B)) == 0) {
+			; // wait
+		}
+		TIFR0 = (1 << OCF0B);
+		TIMSK0 &= ~(1 << OCIE0B);
+		tx_pausing = 0;
+		spi_transmit_next();
+	} else {
+		spi_poll_byte();
+	}
+}
+
+// Interrupt handler for timer 0 compare match B - the end of a pause.
+ISR(TIMER0_COMPB_vect) {
+	TIMSK0 &= ~(1 << OCIE0B);
+	tx_pausing = 0;
+	spi_transmit_next();
+}
+
+#if SPI_TRANSPORT == SPI_TRANSPORT_USART1
+
+/* USART1 has a transmit buffer in front of its shift register, so the next
+ * byte can be written while the current one is being shifted out and bytes
+ * go out back to back. The data register empty interrupt keeps the buffer
+ * full. When the queue runs dry, or a control entry is next, we wait for the
+ * transmit complete interrupt instead so that the select line only changes,
+ * or the pause only starts, once the last byte is out.
+ */
+static void spi_start_byte(uint8_t byte) {
+	// Clear any old transmit complete flag (by writing a 1 to it) so that
+	// it is only set once this byte has been sent
+	UCSR1A = (1 << TXC1);
+	UDR1 = byte;
+	UCSR1B |= (1 << UDRIE1);
+}
+
+// Waits for room in the transmit buffer (or for the transfer to complete,
+// if the queue is empty or a control entry is next) then continues.
+static void spi_poll_byte(void) {
+	while ((UCSR1A & (1 << UDRE1)) == 0) {
+		; // wait
+	}
+	if (tx_head != tx_tail && !ENTRY_IS_CONTROL(tx_tail & SPI_TX_BUFFER_MASK)) {
+		spi_start_byte(tx_buffer[tx_tail & SPI_TX_BUFFER_MASK]);
+		tx_tail++;
+		return;
+	}
+	while ((UCSR1A & (1 << TXC1)) == 0) {
+		; // wait
+	}
+	UCSR1B &= ~((1 << UDRIE1) | (1 << TXCIE1));
+	spi_transmit_next();
+}
+
+// Interrupt handler for USART1 data register empty. Load the next byte
+// from the queue, or wait for the transfer to complete.
+ISR(USART1_UDRE_vect) {
+	if (tx_pausing) {
+		UCSR1B &= ~(1 << UDRIE1);
+	} else if (tx_head != tx_tail && !ENTRY_IS_CONTROL(tx_tail & SPI_TX_BUFFER_MASK)) {
+		spi_start_byte(tx_buffer[tx_tail & SPI_TX_BUFFER_MASK]);
+		tx_tail++;
+	} else {
+		UCSR1B = (UCSR1B & ~(1 << UDRIE1)) | (1 << TXCIE1);
+	}
+}
+
+// Interrupt handler for USART1 transmit complete. Make any slave changes
+// and carry on with the queue (if anything is left).
+ISR(USART1_TX_vect) {
+	UCSR1B &= ~(1 << TXCIE1);
+	spi_transmit_next();
+}
+
+#else
+
+static void spi_start_byte(uint8_t byte) {
+	SPDR0 = byte;
+}
+
+// Waits for the current transfer to complete then starts the next one.
+static void spi_poll_byte(void) {
+	while ((SPSR0 & (1 << SPIF0)) == 0) {
+		; // wait
+	}
+	(void)SPDR0;
+	spi_transmit_next();
 }
+
+// Interrupt handler for SPI transfer complete. Send the next byte from
+// the queue (if any).
+ISR(SPI_STC_vect) {
+	spi_transmit_next();
+}
+
+#endif /* SPI_TRANSPORT */
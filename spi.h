@@ -9,12 +9,68 @@
 
 #include <stdint.h>
 
+// The LED matrix can be driven by the SPI peripheral (SPI0) or by USART1 in
+// master SPI mode (MSPIM). USART1 buffers the next byte while the current
+// one is shifted out, so queued bytes go out back to back, but its clock
+// and data pins are D4 (XCK1) and D3 (TXD1) rather than B7 and B5. These
+// are also the buzzer and pause LED pins, so when USART1 is used the
+// buzzer (sound.c) and the pause LED (game.c) are left disconnected. Select
+// the transport by defining SPI_TRANSPORT when building.
+#define SPI_TRANSPORT_SPI0		0
+#define SPI_TRANSPORT_USART1	1
+#ifndef SPI_TRANSPORT
+#define SPI_TRANSPORT SPI_TRANSPORT_SPI0
+#endif
+
+// Number of bytes that can be waiting in the transmit queue used by
+// spi_enqueue(). Must be a power of 2 no larger than 128.
+#define SPI_TX_BUFFER_SIZE 128
+
 // Set up SPI communication as a master.
 // clockdivider should be one of 2,4,8,16,32,64,128
 void spi_setup_master(uint8_t clockdivider);
 
+// Change the clock divider (as above) once any queued bytes have been sent.
+void spi_set_clock_divider(uint8_t clockdivider);
+
 // Send and receive an SPI byte. This function will take at least 8 
-// cyles of the divided clock (i.e. will busy wait).
+// cyles of the divided clock (i.e. will busy wait). Any queued bytes are
+// sent first. With SPI_TRANSPORT_USART1 nothing is received and 0 is
+// returned.
 uint8_t spi_send_byte(uint8_t byte);
 
+// Add a byte to the transmit queue. The byte is sent by the SPI transfer
+// complete interrupt handler so this returns immediately, unless the queue
+// is full in which case we wait for space. Received bytes are discarded.
+void spi_enqueue(uint8_t byte);
+
+// Slave select lines. Slave 0 uses the SS pin (B4); further slaves use
+// pins A7, A6, A5 and A4 in that order.
+#define SPI_MAX_SLAVES 5
+
+// Make the select lines for slaves 0 to num_slaves - 1 outputs and select
+// slave 0. spi_setup_master() sets up a single slave.
+void spi_setup_slaves(uint8_t num_slaves);
+
+// Add a change of slave to the transmit queue. The bytes queued before this
+// go to the previously selected slave and those queued after it go to the
+// given slave. Invalid slave numbers are ignored.
+void spi_enqueue_select(uint8_t slave);
+
+// Add a pause to the transmit queue. Bytes queued after this are not sent
+// until fine_ticks timer 0 ticks (see get_fine_time()) after the bytes
+// before it have been sent. Pauses are limited to between SPI_MIN_PAUSE and
+// SPI_MAX_PAUSE ticks, and are ignored if fine_ticks is 0 or timer 0 has
+// not been started. Timer 0 compare match B is used to time the pause.
+#define SPI_MIN_PAUSE 2
+#define SPI_MAX_PAUSE 124
+void spi_enqueue_pause(uint8_t fine_ticks);
+
+// Wait until all queued bytes have been sent.
+void spi_flush(void);
+
+// Return the largest number of bytes that have been waiting in the transmit
+// queue at once since spi_setup_master() was called.
+uint8_t spi_tx_high_water_mark(void);
+
 #endif /* SPI_H_ */
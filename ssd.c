@@ -28,7 +28,8 @@ void setup_ssd(){
 	// Set port C (all pins) to outputs
 	DDRC = 0xFF;
 	
-	// Set Port D pin 2 to output
+	// Set Port D pin 2 to output. (This is also RXD1, but the USART1 LED
+	// matrix transport leaves the receiver off - see spi.c.)
 	DDRD |= (1<<DDD2);
 	
 	/* Set up timer/counter 2 so that we get an 
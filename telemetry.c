@@ -0,0 +1,105 @@
+/*
+ * telemetry.c
+ *
+ * Binary stream of the game state, framed with COBS and checked with a
+ * CRC.
+ */
+
+#include "telemetry.h"
+#include <stdint.h>
+#include <util/crc16.h>
+#include "game.h"
+#include "serialio.h"
+#include "timer0.h"
+
+static uint8_t enabled;
+static uint8_t sequence;
+static struct telemetry_stats stats;
+
+void telemetry_set_enabled(uint8_t enabled_in) {
+	enabled = enabled_in;
+}
+
+uint8_t telemetry_is_enabled(void) {
+	return enabled;
+}
+
+uint8_t telemetry_send_frame(uint8_t type, const uint8_t* payload,
+		uint8_t length) {
+	if (!enabled || length > TELEMETRY_MAX_PAYLOAD) {
+		return 0;
+	}
+	uint8_t frame_length = length + TELEMETRY_OVERHEAD;
+	if (serial_output_space() < frame_length) {
+		return 0;
+	}
+	
+	// COBS: each zero is replaced by the distance to the next zero (or to
+	// the end). code_index is where the distance for the current run goes,
+	// filled in when the run ends.
+	uint8_t frame[TELEMETRY_MAX_PAYLOAD + TELEMETRY_OVERHEAD];
+	uint8_t frame_index = 0;
+	frame[frame_index++] = 0;
+	uint8_t code_index = frame_index++;
+	uint16_t crc = 0xFFFF;
+	for (uint8_t i = 0; i < length + 3; i++) {
+		uint8_t byte;
+		if (i == 0) {
+			byte = type;
+		} else if (i <= length) {
+			byte = payload[i - 1];
+		} else if (i == length + 1) {
+			byte = crc & 0xFF;
+		} else {
+			byte = crc >> 8;
+		}
+		if (i <= length) {
+			crc = _crc_ccitt_update(crc, byte);
+		}
+		if (byte) {
+			frame[frame_index++] = byte;
+		} else {
+			frame[code_index] = frame_index - code_index;
+			code_index = frame_index++;
+		}
+	}
+	frame[code_index] = frame_index - code_index;
+	frame[frame_index++] = 0;
+	
+	serial_write((const char*)frame, frame_index);
+	stats.frames_sent++;
+	return 1;
+}
+
+void telemetry_send_state(void) {
+	if (!enabled) {
+		return;
+	}
+	uint8_t payload[STATE_LENGTH];
+	struct ball_data ball;
+	get_ball_data(&ball);
+	uint32_t time = get_current_time();
+	payload[STATE_SEQUENCE] = sequence++;
+	for (uint8_t i = 0; i < 4; i++) {
+		payload[STATE_TIME + i] = time;
+		time >>= 8;
+	}
+	payload[STATE_BALL_X] = ball.ball_x;
+	payload[STATE_BALL_Y] = ball.ball_y;
+	payload[STATE_BALL_X_DIRECTION] = ball.ball_x_direction;
+	payload[STATE_BALL_Y_DIRECTION] = ball.ball_y_direction;
+	payload[STATE_PADDLE_1_Y] = get_player_y(PLAYER_1);
+	payload[STATE_PADDLE_2_Y] = get_player_y(PLAYER_2);
+	payload[STATE_SCORE_1] = get_player_score(PLAYER_1);
+	payload[STATE_SCORE_2] = get_player_score(PLAYER_2);
+	payload[STATE_RALLY_1] = get_player_rally(PLAYER_1);
+	payload[STATE_RALLY_2] = get_player_rally(PLAYER_2);
+	if (!telemetry_send_frame(TELEMETRY_STATE, payload, STATE_LENGTH)) {
+		// There is a newer state on the way, so this one isn't kept
+		stats.frames_dropped++;
+	}
+}
+
+void telemetry_get_stats(struct telemetry_stats* stats_out) {
+	*stats_out = stats;
+}
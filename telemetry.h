@@ -0,0 +1,75 @@
+/*
+ * telemetry.h
+ *
+ * Optional binary stream of the game state for analysis on a host (see
+ * tools/telemetry). Frames go out on the serial port between the terminal
+ * output. Each frame is
+ *
+ *   type, payload..., CRC (2 bytes, low byte first)
+ *
+ * with the CRC (CCITT polynomial, reflected, starting from 0xFFFF - see
+ * _crc_ccitt_update() in avr-libc) taken over the type and payload. The
+ * frame is then COBS encoded so that it contains no zero bytes and sent
+ * with a zero before and after it. Terminal text never contains a zero, so
+ * a decoder can pick the frames out and the CRC rejects the text between
+ * them.
+ *
+ * The host decoder uses the frame layout defined here too.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+// Frame types
+#define TELEMETRY_STATE			(0x01)
+#define TELEMETRY_TRACE			(0x02)		// see trace.h
+
+// Largest payload (COBS needs an extra byte every 254, so keeping frames
+// shorter than that means exactly one extra byte)
+#define TELEMETRY_MAX_PAYLOAD	(32)
+
+// Bytes a frame adds to its payload: type, CRC, COBS overhead byte and
+// the two zeros
+#define TELEMETRY_OVERHEAD		(6)
+
+// TELEMETRY_STATE payload, sent after every ball move. Positions are board
+// squares as in game.h and the time is in milliseconds, low byte first.
+// The rally counts are -1 before the first hit.
+#define STATE_SEQUENCE			(0)
+#define STATE_TIME				(1)		// 4 bytes
+#define STATE_BALL_X			(5)
+#define STATE_BALL_Y			(6)
+#define STATE_BALL_X_DIRECTION	(7)
+#define STATE_BALL_Y_DIRECTION	(8)
+#define STATE_PADDLE_1_Y		(9)
+#define STATE_PADDLE_2_Y		(10)
+#define STATE_SCORE_1			(11)
+#define STATE_SCORE_2			(12)
+#define STATE_RALLY_1			(13)
+#define STATE_RALLY_2			(14)
+#define STATE_LENGTH			(15)
+
+struct telemetry_stats {
+	uint16_t frames_sent;
+	uint16_t frames_dropped;	// state frames that didn't fit in the output buffer
+};
+
+void telemetry_set_enabled(uint8_t enabled);
+uint8_t telemetry_is_enabled(void);
+
+// Send a frame if telemetry is enabled and it fits in the serial output
+// buffer now, rather than waiting. A payload longer than
+// TELEMETRY_MAX_PAYLOAD is never sent. Returns 1 if the frame was sent;
+// otherwise it is up to the caller to keep the payload for later or throw
+// it away (and count it).
+uint8_t telemetry_send_frame(uint8_t type, const uint8_t* payload,
+		uint8_t length);
+
+// Send the current game state as a TELEMETRY_STATE frame
+void telemetry_send_state(void);
+
+void telemetry_get_stats(struct telemetry_stats* stats);
+
+#endif /* TELEMETRY_H_ */
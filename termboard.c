@@ -0,0 +1,158 @@
+/*
+ * termboard.c
+ *
+ * Mirrors the game board on the serial terminal.
+ */
+
+#include "termboard.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "game.h"
+#include "display.h"
+#include "serialio.h"
+#include "terminalio.h"
+#include "fmt.h"
+
+// Value in shown[][] for a square whose contents on the terminal are not
+// known, so that it is always sent
+#define UNKNOWN_SQUARE		(0xFF)
+
+// Terminal column and row of square (x, y). Board row 0 is at the bottom.
+#define SQUARE_COLUMN(x)	(TERMBOARD_X + 1 + 2 * (x))
+#define SQUARE_ROW(y)		(TERMBOARD_Y + BOARD_HEIGHT - (y))
+
+// Most output a square can need (cursor move, colour and two spaces) and
+// the colour reset at the end of an update. We stop an update rather than
+// wait for the output buffer to make room; the squares not sent are still
+// different from shown[][], so the next update picks them up.
+#define SQUARE_MAX_BYTES	(FMT_CURSOR_MAX + 5 + 2)
+#define FINISH_BYTES		(4)
+
+// Background colour of each object
+static const uint8_t OBJECT_BACKGROUNDS[] PROGMEM = {
+	[EMPTY_SQUARE] = BG_BLACK,
+	[PLAYER] = BG_GREEN,
+	[BALL] = BG_RED,
+	[OBSTACLE] = BG_YELLOW,
+	[GUIDE] = BG_CYAN
+};
+
+// What the terminal is showing in each square
+static uint8_t shown[BOARD_WIDTH][BOARD_HEIGHT];
+
+static uint8_t enabled = 1;
+static uint8_t full_redraw_pending;
+static uint16_t redraw_bytes;
+static struct termboard_stats stats;
+
+static void forget_squares(void);
+
+void termboard_set_enabled(uint8_t enabled_in) {
+	if (enabled_in && !enabled) {
+		enabled = 1;
+		termboard_redraw();
+	}
+	enabled = enabled_in;
+}
+
+uint8_t termboard_is_enabled(void) {
+	return enabled;
+}
+
+void termboard_redraw(void) {
+	if (!enabled) {
+		return;
+	}
+	draw_horizontal_line(TERMBOARD_Y, TERMBOARD_X,
+			SQUARE_COLUMN(BOARD_WIDTH));
+	draw_horizontal_line(SQUARE_ROW(-1), TERMBOARD_X,
+			SQUARE_COLUMN(BOARD_WIDTH));
+	draw_vertical_line(TERMBOARD_X, SQUARE_ROW(BOARD_HEIGHT - 1),
+			SQUARE_ROW(0));
+	draw_vertical_line(SQUARE_COLUMN(BOARD_WIDTH),
+			SQUARE_ROW(BOARD_HEIGHT - 1), SQUARE_ROW(0));
+	forget_squares();
+}
+
+void termboard_think(void) {
+	if (!enabled) {
+		return;
+	}
+	// The cursor and colour are unknown to start with as other output may
+	// have happened since the last update. After that we only move the
+	// cursor or change the colour when the next changed square needs it.
+	uint32_t start_bytes = serial_bytes_output();
+	uint8_t cursor_x = UNKNOWN_SQUARE;
+	uint8_t cursor_y = UNKNOWN_SQUARE;
+	uint8_t background = 0;
+	uint8_t complete = 1;
+	for (int8_t y = BOARD_HEIGHT - 1; y >= 0 && complete; y--) {
+		for (uint8_t x = 0; x < BOARD_WIDTH; x++) {
+			uint8_t object = get_board_object(x, y);
+			if (object == shown[x][y]) {
+				continue;
+			}
+			if (serial_output_space() < SQUARE_MAX_BYTES + FINISH_BYTES) {
+				complete = 0;
+				break;
+			}
+			if (x != cursor_x || y != cursor_y) {
+				move_terminal_cursor(SQUARE_COLUMN(x), SQUARE_ROW(y));
+			}
+			uint8_t new_background = pgm_read_byte(&OBJECT_BACKGROUNDS[object]);
+			if (new_background != background) {
+				set_display_attribute(new_background);
+				background = new_background;
+			}
+			serial_write_P(PSTR("  "));
+			shown[x][y] = object;
+			cursor_x = x + 1;
+			cursor_y = y;
+		}
+	}
+	if (!background) {
+		// Nothing was sent
+		return;
+	}
+	normal_display_mode();
+	
+	uint16_t frame_bytes = serial_bytes_output() - start_bytes;
+	stats.frames++;
+	stats.bytes_sent += frame_bytes;
+	stats.last_frame_bytes = frame_bytes;
+	if (frame_bytes > stats.max_frame_bytes) {
+		stats.max_frame_bytes = frame_bytes;
+	}
+	if (full_redraw_pending) {
+		// A full redraw may take several updates
+		redraw_bytes += frame_bytes;
+		if (complete) {
+			stats.full_redraw_bytes = redraw_bytes;
+			full_redraw_pending = 0;
+		}
+	}
+}
+
+void termboard_get_stats(struct termboard_stats* stats_out) {
+	*stats_out = stats;
+}
+
+void termboard_print_stats(void) {
+	move_terminal_cursor(10,22);
+	clear_to_end_of_line();
+	printf_P(PSTR("Terminal board bytes/update last/max: %u/%u  "
+			"full redraw: %u  updates: %lu"), stats.last_frame_bytes,
+			stats.max_frame_bytes, stats.full_redraw_bytes, stats.frames);
+}
+
+// Mark every square as unknown so the next update sends them all
+static void forget_squares(void) {
+	for (uint8_t x = 0; x < BOARD_WIDTH; x++) {
+		for (uint8_t y = 0; y < BOARD_HEIGHT; y++) {
+			shown[x][y] = UNKNOWN_SQUARE;
+		}
+	}
+	full_redraw_pending = 1;
+	redraw_bytes = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * termboard.h
+ *
+ * Mirrors the game board on the serial terminal, two characters per square
+ * with the square's colour as the background. A copy of what the terminal
+ * shows is kept, and each update only sends the squares that have changed.
+ * At 19200 baud only about 1900 bytes can be sent each second, and a full
+ * redraw of the board is several hundred bytes, so redrawing every frame
+ * is not an option.
+ */
+
+#ifndef TERMBOARD_H_
+#define TERMBOARD_H_
+
+#include <stdint.h>
+
+// Terminal position of the top left corner of the board's border. The
+// squares start one row and one column further in.
+#define TERMBOARD_X			(50)
+#define TERMBOARD_Y			(1)
+
+// Time between updates (ms)
+#define TERMBOARD_PERIOD_MS	(100)
+
+struct termboard_stats {
+	uint32_t frames;			// Updates that sent at least one square
+	uint32_t bytes_sent;
+	uint16_t last_frame_bytes;
+	uint16_t max_frame_bytes;
+	uint16_t full_redraw_bytes;	// Bytes sent by the last full redraw
+};
+
+// Turn the mirror on or off. It is on by default.
+void termboard_set_enabled(uint8_t enabled);
+uint8_t termboard_is_enabled(void);
+
+// Draw the border and mark every square as needing to be sent. This must be
+// called after the terminal is cleared.
+void termboard_redraw(void);
+
+// Send the squares that have changed, if the mirror is on. This should be
+// called every TERMBOARD_PERIOD_MS (it is a scheduler task, see sched.h).
+void termboard_think(void);
+
+void termboard_get_stats(struct termboard_stats* stats);
+
+// Print the byte counts to the terminal
+void termboard_print_stats(void);
+
+#endif /* TERMBOARD_H_ */
@@ -8,63 +8,405 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <avr/pgmspace.h>
+#include "serialio.h"
+#include "fmt.h"
+
+// A coordinate we don't know (rows and columns start at 1)
+#define UNKNOWN				(0)
+
+// What we know about the terminal, worked out from everything added to the
+// serial output (see observe_output()). The cursor is UNKNOWN after
+// anything we can't follow, until the next absolute move.
+static uint8_t cursor_x;
+static uint8_t cursor_y;
+static uint8_t scroll_top;			// 1 if the whole display scrolls
+static uint8_t scroll_bottom;		// UNKNOWN if the whole display scrolls
+static uint8_t attributes_known;
+static uint8_t foreground;			// FG_... or 0 for the default
+static uint8_t background;			// BG_... or 0 for the default
+static uint8_t modes;				// bit n - 1 set if mode n (1 to 8) is on
+
+// Parser state for observe_output()
+#define PARSE_TEXT			(0)
+#define PARSE_ESCAPE		(1)		// ESC received
+#define PARSE_CSI			(2)		// ESC [ received
+#define PARSE_FRAME			(3)		// inside a telemetry frame
+#define MAX_PARAMETERS		(2)
+static uint8_t parse_state;
+static uint8_t parameters[MAX_PARAMETERS];
+static uint8_t num_parameters;
+static uint8_t private_sequence;	// ESC [ ? ...
+
+static struct terminal_stats stats;
+
+static void forget_position(void) {
+	cursor_x = UNKNOWN;
+	cursor_y = UNKNOWN;
+}
+
+static void reset_attributes(void) {
+	attributes_known = 1;
+	foreground = 0;
+	background = 0;
+	modes = 0;
+}
+
+// The lowest row a move down from the cursor can reach: the bottom of the
+// scroll region if the cursor is in it, otherwise the bottom of the display
+static uint8_t lowest_row(void) {
+	if (scroll_bottom != UNKNOWN && cursor_y <= scroll_bottom) {
+		return scroll_bottom;
+	}
+	return TERMINAL_HEIGHT;
+}
+
+// Move down a line as LF and ESC D do, scrolling at the bottom of the
+// scroll region or display
+static void line_feed(void) {
+	if (cursor_y != UNKNOWN && cursor_y < lowest_row()) {
+		cursor_y++;
+	}
+}
+
+// Apply a select graphic rendition parameter
+static void apply_attribute(uint8_t parameter) {
+	if (parameter == TERM_RESET) {
+		reset_attributes();
+	} else if (parameter >= FG_BLACK && parameter <= FG_WHITE) {
+		foreground = parameter;
+	} else if (parameter >= BG_BLACK && parameter <= BG_WHITE) {
+		background = parameter;
+	} else if (parameter <= TERM_HIDDEN) {
+		modes |= (1 << (parameter - 1));
+	} else {
+		attributes_known = 0;
+	}
+}
+
+// Follow the effect of a complete ESC [ sequence ending in final
+static void apply_csi(char final) {
+	uint8_t count = parameters[0] ? parameters[0] : 1;
+	if (private_sequence) {
+		// Only used to show and hide the cursor
+		return;
+	}
+	switch (final) {
+		case 'H':
+		case 'f':
+			cursor_y = parameters[0] ? parameters[0] : 1;
+			cursor_x = parameters[1] ? parameters[1] : 1;
+			break;
+		case 'A':
+			if (cursor_y != UNKNOWN) {
+				cursor_y = (cursor_y > count) ? cursor_y - count : 1;
+			}
+			break;
+		case 'B':
+			if (cursor_y != UNKNOWN) {
+				uint8_t lowest = lowest_row();
+				cursor_y = (lowest - cursor_y > count) ?
+						cursor_y + count : lowest;
+			}
+			break;
+		case 'C':
+			if (cursor_x != UNKNOWN) {
+				cursor_x += count;
+				if (cursor_x > TERMINAL_WIDTH) {
+					cursor_x = TERMINAL_WIDTH;
+				}
+			}
+			break;
+		case 'D':
+			if (cursor_x != UNKNOWN) {
+				cursor_x = (cursor_x > count) ? cursor_x - count : 1;
+			}
+			break;
+		case 'J':
+		case 'K':
+			break;
+		case 'm':
+			if (!num_parameters) {
+				reset_attributes();
+			}
+			for (uint8_t i = 0; i < num_parameters; i++) {
+				apply_attribute(parameters[i]);
+			}
+			break;
+		case 'r':
+			// Setting the scroll region also homes the cursor
+			scroll_top = parameters[0] ? parameters[0] : 1;
+			scroll_bottom = parameters[1];
+			cursor_x = 1;
+			cursor_y = 1;
+			break;
+		default:
+			forget_position();
+			break;
+	}
+}
+
+// Follow the effect of output on the cursor and attributes. Called by
+// serialio with everything added to the output buffer.
+static void observe_output(const char* data, uint8_t length) {
+	while (length--) {
+		char c = *data++;
+		switch (parse_state) {
+			case PARSE_TEXT:
+				if (c == '\x1b') {
+					parse_state = PARSE_ESCAPE;
+				} else if (c == '\r') {
+					cursor_x = 1;
+				} else if (c == '\n') {
+					line_feed();
+				} else if (c == '\b') {
+					if (cursor_x > 1) {
+						cursor_x--;
+					}
+				} else if (c == 0) {
+					// A telemetry frame - who knows what the terminal
+					// makes of it
+					parse_state = PARSE_FRAME;
+					forget_position();
+					attributes_known = 0;
+				} else if ((uint8_t)c >= ' ' && cursor_x != UNKNOWN) {
+					// Past the last column the terminal may or may not
+					// have wrapped
+					if (++cursor_x > TERMINAL_WIDTH) {
+						forget_position();
+					}
+				} else if ((uint8_t)c < ' ') {
+					forget_position();
+				}
+				break;
+			case PARSE_ESCAPE:
+				parse_state = PARSE_TEXT;
+				if (c == '[') {
+					parse_state = PARSE_CSI;
+					parameters[0] = 0;
+					parameters[1] = 0;
+					num_parameters = 0;
+					private_sequence = 0;
+				} else if (c == 'D') {
+					line_feed();
+				} else if (c == 'M') {
+					// Move up, scrolling at the top of the scroll region
+					if (cursor_y > 1 && cursor_y != scroll_top) {
+						cursor_y--;
+					}
+				} else {
+					forget_position();
+				}
+				break;
+			case PARSE_CSI:
+				if (c >= '0' && c <= '9') {
+					if (!num_parameters) {
+						num_parameters = 1;
+					}
+					if (num_parameters <= MAX_PARAMETERS) {
+						uint8_t* parameter = &parameters[num_parameters - 1];
+						*parameter = *parameter * 10 + (c - '0');
+					}
+				} else if (c == ';') {
+					num_parameters = num_parameters ? num_parameters + 1 : 2;
+				} else if (c == '?') {
+					private_sequence = 1;
+				} else {
+					if (num_parameters > MAX_PARAMETERS) {
+						forget_position();
+						attributes_known = 0;
+					} else {
+						apply_csi(c);
+					}
+					parse_state = PARSE_TEXT;
+				}
+				break;
+			default:
+				if (c == 0) {
+					parse_state = PARSE_TEXT;
+				}
+				break;
+		}
+	}
+}
+
+void init_terminal(void) {
+	forget_position();
+	attributes_known = 0;
+	scroll_top = 1;
+	scroll_bottom = UNKNOWN;
+	parse_state = PARSE_TEXT;
+	serial_set_output_hook(observe_output);
+}
+
+// Write ESC [ count final, leaving out the count if it is 1. Returns the
+// number of characters written.
+static uint8_t fmt_csi(char* buffer, uint8_t count, char final) {
+	uint8_t length = 0;
+	buffer[length++] = '\x1b';
+	buffer[length++] = '[';
+	if (count != 1) {
+		length += fmt_uint(&buffer[length], count);
+	}
+	buffer[length++] = final;
+	return length;
+}
+
+// Number of characters fmt_csi() writes
+static uint8_t csi_length(uint8_t count) {
+	return (count == 1) ? 3 : (count < 10) ? 4 : (count < 100) ? 5 : 6;
+}
+
+// Write the shortest way of getting from column from to column to on the
+// same row: carriage return, backspaces, a relative move, or a carriage
+// return and a move right. Returns the number of characters written.
+static uint8_t fmt_horizontal(char* buffer, uint8_t from, uint8_t to) {
+	if (to == from) {
+		return 0;
+	}
+	if (to == 1) {
+		buffer[0] = '\r';
+		return 1;
+	}
+	uint8_t return_length = 1 + csi_length(to - 1);
+	if (to > from) {
+		if (csi_length(to - from) <= return_length) {
+			return fmt_csi(buffer, to - from, 'C');
+		}
+	} else {
+		uint8_t back = from - to;
+		if (back <= 3 && back <= return_length) {
+			for (uint8_t i = 0; i < back; i++) {
+				buffer[i] = '\b';
+			}
+			return back;
+		}
+		if (csi_length(back) <= return_length) {
+			return fmt_csi(buffer, back, 'D');
+		}
+	}
+	buffer[0] = '\r';
+	return 1 + fmt_csi(&buffer[1], to - 1, 'C');
+}
+
+// Write the shortest way of getting from row from to row to in the same
+// column: line feeds or a relative move. Returns the number of characters
+// written, or NO_RELATIVE_MOVE if the move crosses a scroll region margin
+// (where relative moves stop and line feeds scroll).
+#define NO_RELATIVE_MOVE	(0xFF)
+static uint8_t fmt_vertical(char* buffer, uint8_t from, uint8_t to) {
+	if (to == from) {
+		return 0;
+	}
+	if (scroll_bottom != UNKNOWN && ((from <= scroll_bottom &&
+			to > scroll_bottom) || (from >= scroll_top && to < scroll_top))) {
+		return NO_RELATIVE_MOVE;
+	}
+	if (to < from) {
+		return fmt_csi(buffer, from - to, 'A');
+	}
+	uint8_t down = to - from;
+	if (down <= 3) {
+		for (uint8_t i = 0; i < down; i++) {
+			buffer[i] = '\n';
+		}
+		return down;
+	}
+	return fmt_csi(buffer, down, 'B');
+}
 
 void move_terminal_cursor(int x, int y) {
-    printf_P(PSTR("\x1b[%d;%dH"), y, x);
+	char buffer[FMT_CURSOR_MAX];
+	uint8_t length = fmt_cursor(buffer, x, y);
+	stats.moves++;
+	if (cursor_x != UNKNOWN && cursor_y != UNKNOWN) {
+		if (x == cursor_x && y == cursor_y) {
+			stats.bytes_saved += length;
+			return;
+		}
+		// A relative move is at most two moves of 6 characters
+		char relative[12];
+		uint8_t horizontal_length = fmt_horizontal(relative, cursor_x, x);
+		uint8_t vertical_length = fmt_vertical(&relative[horizontal_length],
+				cursor_y, y);
+		uint8_t relative_length = horizontal_length + vertical_length;
+		if (vertical_length != NO_RELATIVE_MOVE && relative_length < length) {
+			stats.bytes_saved += length - relative_length;
+			serial_write(relative, relative_length);
+			return;
+		}
+	}
+	serial_write(buffer, length);
 }
 
 void normal_display_mode(void) {
-	printf_P(PSTR("\x1b[0m"));
+	if (attributes_known && !foreground && !background && !modes) {
+		stats.bytes_saved += 4;
+		return;
+	}
+	serial_write_P(PSTR("\x1b[0m"));
 }
 
 void reverse_video(void) {
-	printf_P(PSTR("\x1b[7m"));
+	set_display_attribute(TERM_REVERSE);
 }
 
 void clear_terminal(void) {
-	printf_P(PSTR("\x1b[2J"));
+	serial_write_P(PSTR("\x1b[2J"));
 }
 
 void clear_to_end_of_line(void) {
-	printf_P(PSTR("\x1b[K"));
+	serial_write_P(PSTR("\x1b[K"));
 }
 
 void set_display_attribute(DisplayParameter parameter) {
-	printf_P(PSTR("\x1b[%dm"), parameter);
+	if (parameter == TERM_RESET) {
+		normal_display_mode();
+		return;
+	}
+	char buffer[2 + FMT_UINT_MAX + 1];
+	uint8_t length = fmt_attribute(buffer, parameter);
+	if (attributes_known && ((parameter == foreground) ||
+			(parameter == background) || (parameter >= TERM_BRIGHT &&
+			parameter <= TERM_HIDDEN && (modes & (1 << (parameter - 1)))))) {
+		stats.bytes_saved += length;
+		return;
+	}
+	serial_write(buffer, length);
 }
 
 void hide_cursor() {
-	printf_P(PSTR("\x1b[?25l"));
+	serial_write_P(PSTR("\x1b[?25l"));
 }
 
 void show_cursor() {
-	printf_P(PSTR("\x1b[?25h"));
+	serial_write_P(PSTR("\x1b[?25h"));
 }
 
 void enable_scrolling_for_whole_display(void) {
-	printf_P(PSTR("\x1b[r"));
+	serial_write_P(PSTR("\x1b[r"));
 }
 
 void set_scroll_region(int8_t y1, int8_t y2) {
-	printf_P(PSTR("\x1b[%d;%dr"), y1, y2);
+	char buffer[FMT_CURSOR_MAX];
+	uint8_t length = fmt_cursor(buffer, y2, y1);
+	// Same form as a cursor move, but ending in r
+	buffer[length - 1] = 'r';
+	serial_write(buffer, length);
 }
 
 void scroll_down(void) {
-	printf_P(PSTR("\x1bM"));	// ESC-M
+	serial_write_P(PSTR("\x1bM"));	// ESC-M
 }
 
 void scroll_up(void) {
-	printf_P(PSTR("\x1b\x44"));	// ESC-D
+	serial_write_P(PSTR("\x1b\x44"));	// ESC-D
 }
 
 void draw_horizontal_line(int8_t y, int8_t start_x, int8_t end_x) {
 	move_terminal_cursor(start_x, y);
 	reverse_video();
 	for (int8_t i = start_x; i <= end_x; i++) {
-		printf(" ");	/* No need to use printf_P - printing 
-						 * a single character gets optimised
-						 * to a putchar call 
-						 */
+		serial_write_P(PSTR(" "));
 	}
 	normal_display_mode();
 }
@@ -73,13 +415,18 @@ void draw_vertical_line(int8_t x, int8_t start_y, int8_t end_y) {
 	move_terminal_cursor(x, start_y);
 	reverse_video();
 	for(int8_t i = start_y; i < end_y; i++) {
-		printf(" ");
-		/* Move down one and back to the left one */
-		printf_P(PSTR("\x1b[B\x1b[D"));
+		serial_write_P(PSTR(" "));
+		// Back to the line (backspace and line feed when we know where
+		// the cursor is)
+		move_terminal_cursor(x, i + 1);
 	}
-	printf(" ");
+	serial_write_P(PSTR(" "));
 	normal_display_mode();
 }
 
+void terminal_get_stats(struct terminal_stats* stats_out) {
+	*stats_out = stats;
+}
+
 
-//////////////////////////////////EXTRA FUNCTIONS/////////////////////////////
\ No newline at end of file
+//////////////////////////////////EXTRA FUNCTIONS/////////////////////////////
@@ -54,6 +54,24 @@ typedef enum {
 	BG_WHITE = 47
 } DisplayParameter;
 
+// Width of the terminal in columns
+#define TERMINAL_WIDTH	(80)
+
+// Height of the terminal in rows. This is a build setting: the game, its
+// status lines and the event log pane fit in 24 rows, but the statistics
+// printed on request go down to the scheduler's (see sched.h), which need
+// 52. Build with e.g. -DTERMINAL_HEIGHT=24 for a standard terminal.
+#ifndef TERMINAL_HEIGHT
+#define TERMINAL_HEIGHT	(52)
+#endif
+
+// Start keeping track of the cursor and attributes from everything sent
+// (call after init_serial_stdio()). Until the first absolute cursor move
+// and attribute reset, nothing is assumed. After that, cursor moves use the
+// shortest sequence from where the cursor is (or nothing if it is there
+// already) and attributes already set are not sent again.
+void init_terminal(void);
+
 void move_terminal_cursor(int x, int y);
 void normal_display_mode(void);
 void reverse_video(void);
@@ -87,4 +105,12 @@ void draw_vertical_line(int8_t x, int8_t starty, int8_t endy);
 
 ///////////////////////////EXTRA FUNCTIONS///////////////////////////////
 
+struct terminal_stats {
+	uint16_t moves;			// calls to move_terminal_cursor()
+	uint32_t bytes_saved;	// compared with absolute moves and every
+							// attribute sent
+};
+
+void terminal_get_stats(struct terminal_stats* stats);
+
 #endif /* TERMINAL_IO_H */
@@ -16,6 +16,12 @@
  * millisecond. Will overflow every ~49 days. */
 static volatile uint32_t clock_ticks_ms;
 
+/* Render tick - render_tick is set every render_period milliseconds
+ * and is cleared when read by render_tick_occurred(). */
+static volatile uint8_t render_period;
+static volatile uint8_t render_countdown;
+static volatile uint8_t render_tick;
+
 /* Set up timer 0 to generate an interrupt every 1ms. 
  * We will divide the clock by 64 and count up to 124.
  * We will therefore get an interrupt every 64 x 125
@@ -72,7 +78,52 @@ uint32_t get_current_time(void) {
 	return return_value;
 }
 
+uint16_t get_fine_time(void) {
+	uint16_t ms;
+	uint8_t count;
+	
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	ms = (uint16_t)clock_ticks_ms;
+	count = TCNT0;
+	/* If the counter has just been reset but the interrupt hasn't run yet
+	 * then the millisecond count is one behind.
+	 */
+	if ((TIFR0 & (1 << OCF0A)) && count < OCR0A) {
+		ms++;
+	}
+	if (interrupts_were_enabled) {
+		sei();
+	}
+	return ms * FINE_TICKS_PER_MS + count;
+}
+
+void set_render_period(uint8_t period_ms) {
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	render_period = period_ms;
+	render_countdown = period_ms;
+	render_tick = 0;
+	if (interrupts_were_enabled) {
+		sei();
+	}
+}
+
+uint8_t render_tick_occurred(void) {
+	if (render_tick) {
+		render_tick = 0;
+		return 1;
+	}
+	return 0;
+}
+
 ISR(TIMER0_COMPA_vect) {
 	/* Increment our clock tick count */
 	clock_ticks_ms++;
+	
+	/* Raise a render tick every render_period milliseconds */
+	if (render_period && --render_countdown == 0) {
+		render_countdown = render_period;
+		render_tick = 1;
+	}
 }
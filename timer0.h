@@ -30,4 +30,23 @@ void init_timer0(void);
  */
 uint32_t get_current_time(void);
 
+/* Return a fine grained timer value which counts up every 8 microseconds
+ * and wraps around every 524 milliseconds. This is only useful for measuring
+ * short intervals (subtract two values). Multiply an interval by
+ * US_PER_FINE_TICK in 32 bits for microseconds, as over 65 ms won't fit in
+ * 16.
+ */
+#define FINE_TICKS_PER_MS 125
+#define US_PER_FINE_TICK (1000 / FINE_TICKS_PER_MS)
+uint16_t get_fine_time(void);
+
+/* Set the period (in milliseconds) of the render tick. A period of 0
+ * stops the render tick.
+ */
+void set_render_period(uint8_t period_ms);
+
+/* Return 1 if a render tick has occurred since the last call, 0 otherwise.
+ */
+uint8_t render_tick_occurred(void);
+
 #endif /* TIMER0_H_ */
@@ -0,0 +1,16 @@
+/*
+ * host.h
+ *
+ * Extra functions provided by the host versions of spi.c and timer0.c.
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdint.h>
+
+// Move the emulated clock forward. Render ticks that fall within the time
+// are reported by render_tick_occurred().
+void host_advance_time(uint32_t ms);
+
+#endif /* HOST_H_ */
@@ -0,0 +1,19 @@
+/*
+ * avr/eeprom.h
+ *
+ * Host stand-in for the avr-libc header. EEMEM variables are ordinary
+ * (zeroed) memory, so nothing saved survives between runs.
+ */
+
+#ifndef HOST_AVR_EEPROM_H_
+#define HOST_AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_read_block(dst, src, n) memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n) memcpy((dst), (src), (n))
+
+#endif /* HOST_AVR_EEPROM_H_ */
@@ -0,0 +1,13 @@
+/*
+ * avr/io.h
+ *
+ * Host stand-in for the avr-libc header. The display modules built by the
+ * emulator do not touch any registers, so nothing is defined here.
+ */
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+#endif /* HOST_AVR_IO_H_ */
@@ -0,0 +1,28 @@
+/*
+ * avr/pgmspace.h
+ *
+ * Host stand-in for the avr-libc header. Program memory is ordinary memory
+ * on the host, so the _P functions map onto the standard library ones.
+ */
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_ptr(address) (*(const void* const*)(address))
+
+#define printf_P printf
+#define sprintf_P sprintf
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
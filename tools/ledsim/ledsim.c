@@ -0,0 +1,261 @@
+/*
+ * ledsim.c
+ *
+ * Host emulation of the LED matrix panels.
+ */
+
+#include "ledsim.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CMD_UPDATE_ALL		(0x00)
+#define CMD_UPDATE_PIXEL	(0x01)
+#define CMD_UPDATE_ROW		(0x02)
+#define CMD_UPDATE_COL		(0x03)
+#define CMD_SHIFT_DISPLAY	(0x04)
+#define CMD_CLEAR_SCREEN	(0x0F)
+
+// Longest command (update all) including the command byte
+#define MAX_COMMAND_BYTES	(1 + PANEL_NUM_COLUMNS * MATRIX_NUM_ROWS)
+
+// A panel and the command it is part way through receiving
+struct panel {
+	PixelColour pixels[PANEL_NUM_COLUMNS][MATRIX_NUM_ROWS];
+	uint8_t command[MAX_COMMAND_BYTES];
+	uint8_t received;	// Bytes of command received so far
+	uint8_t expected;	// Length of command, or 0 if waiting for one
+};
+
+static struct panel panels[LEDMATRIX_NUM_PANELS];
+static uint8_t selected;
+static struct ledsim_counts frame_counts;
+static struct ledsim_counts totals;
+
+static uint8_t command_length(uint8_t command);
+static void execute(struct panel* panel);
+static void shift(struct panel* panel, uint8_t directions);
+static void add_counts(struct ledsim_counts* to,
+		const struct ledsim_counts* from);
+
+void ledsim_reset(void) {
+	memset(panels, 0, sizeof(panels));
+	selected = 0;
+	memset(&frame_counts, 0, sizeof(frame_counts));
+	memset(&totals, 0, sizeof(totals));
+}
+
+void ledsim_select(uint8_t panel) {
+	if (panel < LEDMATRIX_NUM_PANELS) {
+		selected = panel;
+	}
+}
+
+void ledsim_receive(uint8_t byte) {
+	struct panel* panel = &panels[selected];
+	frame_counts.bytes++;
+	if (!panel->expected) {
+		panel->expected = command_length(byte);
+		if (!panel->expected) {
+			frame_counts.bad_bytes++;
+			return;
+		}
+		panel->received = 0;
+	}
+	panel->command[panel->received++] = byte;
+	if (panel->received == panel->expected) {
+		execute(panel);
+		panel->expected = 0;
+	}
+}
+
+void ledsim_end_frame(struct ledsim_counts* frame) {
+	if (frame) {
+		*frame = frame_counts;
+	}
+	add_counts(&totals, &frame_counts);
+	memset(&frame_counts, 0, sizeof(frame_counts));
+}
+
+void ledsim_get_totals(struct ledsim_counts* totals_out) {
+	*totals_out = totals;
+}
+
+PixelColour ledsim_get_pixel(uint8_t x, uint8_t y) {
+	if (x >= MATRIX_NUM_COLUMNS || y >= MATRIX_NUM_ROWS) {
+		return COLOUR_BLACK;
+	}
+	return panels[x / PANEL_NUM_COLUMNS].pixels[x % PANEL_NUM_COLUMNS][y];
+}
+
+// FNV-1a over the pixels, left to right then bottom to top
+uint32_t ledsim_hash(void) {
+	uint32_t hash = 2166136261u;
+	for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		for (uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+			hash = (hash ^ ledsim_get_pixel(x, y)) * 16777619u;
+		}
+	}
+	return hash;
+}
+
+// Each pixel colour has 4 bits of green in the high nibble and 4 bits of red
+// in the low nibble (see pixel_colour.h)
+#define RED_OF(pixel)	(((pixel) & 0x0F) * 17)
+#define GREEN_OF(pixel)	(((pixel) >> 4) * 17)
+
+void ledsim_render_ansi(FILE* out) {
+	for (int8_t y = MATRIX_NUM_ROWS - 1; y >= 0; y--) {
+		for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+			PixelColour pixel = ledsim_get_pixel(x, y);
+			fprintf(out, "\x1b[48;2;%d;%d;0m  ", RED_OF(pixel), GREEN_OF(pixel));
+		}
+		fprintf(out, "\x1b[0m\n");
+	}
+}
+
+int ledsim_write_ppm(const char* filename, uint8_t scale) {
+	FILE* out = fopen(filename, "wb");
+	if (!out) {
+		return -1;
+	}
+	fprintf(out, "P6\n%d %d\n255\n", MATRIX_NUM_COLUMNS * scale,
+			MATRIX_NUM_ROWS * scale);
+	for (int8_t y = MATRIX_NUM_ROWS - 1; y >= 0; y--) {
+		for (uint8_t line = 0; line < scale; line++) {
+			for (uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				PixelColour pixel = ledsim_get_pixel(x, y);
+				for (uint8_t i = 0; i < scale; i++) {
+					fputc(RED_OF(pixel), out);
+					fputc(GREEN_OF(pixel), out);
+					fputc(0, out);
+				}
+			}
+		}
+	}
+	return fclose(out) ? -1 : 0;
+}
+
+// Return the number of bytes in the given command (including the command
+// byte itself), or 0 if it is not a valid command
+static uint8_t command_length(uint8_t command) {
+	switch (command) {
+		case CMD_UPDATE_ALL:
+			return 1 + PANEL_NUM_COLUMNS * MATRIX_NUM_ROWS;
+		case CMD_UPDATE_PIXEL:
+			return 3;
+		case CMD_UPDATE_ROW:
+			return 2 + PANEL_NUM_COLUMNS;
+		case CMD_UPDATE_COL:
+			return 2 + MATRIX_NUM_ROWS;
+		case CMD_SHIFT_DISPLAY:
+			return 2;
+		case CMD_CLEAR_SCREEN:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// Apply a complete command to the panel. Commands with an out of range
+// argument are counted as bad bytes and ignored, as the panel does.
+static void execute(struct panel* panel) {
+	uint8_t* data = panel->command;
+	uint8_t x, y;
+	enum ledsim_command type;
+	
+	switch (data[0]) {
+		case CMD_UPDATE_ALL:
+			type = LEDSIM_UPDATE_ALL;
+			for (y = 0; y < MATRIX_NUM_ROWS; y++) {
+				for (x = 0; x < PANEL_NUM_COLUMNS; x++) {
+					panel->pixels[x][y] = data[1 + y * PANEL_NUM_COLUMNS + x];
+				}
+			}
+			break;
+		case CMD_UPDATE_PIXEL:
+			type = LEDSIM_UPDATE_PIXEL;
+			x = data[1] & 0x0F;
+			y = data[1] >> 4;
+			if (y >= MATRIX_NUM_ROWS) {
+				frame_counts.bad_bytes += panel->expected;
+				return;
+			}
+			panel->pixels[x][y] = data[2];
+			break;
+		case CMD_UPDATE_ROW:
+			type = LEDSIM_UPDATE_ROW;
+			y = data[1];
+			if (y >= MATRIX_NUM_ROWS) {
+				frame_counts.bad_bytes += panel->expected;
+				return;
+			}
+			for (x = 0; x < PANEL_NUM_COLUMNS; x++) {
+				panel->pixels[x][y] = data[2 + x];
+			}
+			break;
+		case CMD_UPDATE_COL:
+			type = LEDSIM_UPDATE_COL;
+			x = data[1];
+			if (x >= PANEL_NUM_COLUMNS) {
+				frame_counts.bad_bytes += panel->expected;
+				return;
+			}
+			for (y = 0; y < MATRIX_NUM_ROWS; y++) {
+				panel->pixels[x][y] = data[2 + y];
+			}
+			break;
+		case CMD_SHIFT_DISPLAY:
+			type = LEDSIM_SHIFT;
+			shift(panel, data[1]);
+			break;
+		default:
+			type = LEDSIM_CLEAR;
+			memset(panel->pixels, 0, sizeof(panel->pixels));
+			break;
+	}
+	frame_counts.commands++;
+	frame_counts.by_command[type]++;
+}
+
+// Shift the panel one pixel in each direction whose bit is set: 0x01 right,
+// 0x02 left, 0x04 down and 0x08 up. Pixels shifted in are black.
+static void shift(struct panel* panel, uint8_t directions) {
+	uint8_t x, y;
+	if (directions & 0x01) {
+		for (x = PANEL_NUM_COLUMNS - 1; x > 0; x--) {
+			memcpy(panel->pixels[x], panel->pixels[x - 1], MATRIX_NUM_ROWS);
+		}
+		memset(panel->pixels[0], 0, MATRIX_NUM_ROWS);
+	}
+	if (directions & 0x02) {
+		for (x = 0; x < PANEL_NUM_COLUMNS - 1; x++) {
+			memcpy(panel->pixels[x], panel->pixels[x + 1], MATRIX_NUM_ROWS);
+		}
+		memset(panel->pixels[PANEL_NUM_COLUMNS - 1], 0, MATRIX_NUM_ROWS);
+	}
+	for (x = 0; x < PANEL_NUM_COLUMNS; x++) {
+		if (directions & 0x04) {
+			for (y = 0; y < MATRIX_NUM_ROWS - 1; y++) {
+				panel->pixels[x][y] = panel->pixels[x][y + 1];
+			}
+			panel->pixels[x][MATRIX_NUM_ROWS - 1] = COLOUR_BLACK;
+		}
+		if (directions & 0x08) {
+			for (y = MATRIX_NUM_ROWS - 1; y > 0; y--) {
+				panel->pixels[x][y] = panel->pixels[x][y - 1];
+			}
+			panel->pixels[x][0] = COLOUR_BLACK;
+		}
+	}
+}
+
+static void add_counts(struct ledsim_counts* to,
+		const struct ledsim_counts* from) {
+	to->bytes += from->bytes;
+	to->commands += from->commands;
+	to->bad_bytes += from->bad_bytes;
+	for (uint8_t i = 0; i < LEDSIM_NUM_COMMANDS; i++) {
+		to->by_command[i] += from->by_command[i];
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * ledsim.h
+ *
+ * Host emulation of the LED matrix panels. Bytes sent over SPI are decoded
+ * as LED matrix commands (see ledmatrix.c) and applied to a virtual copy of
+ * each panel. The bytes and commands received are counted per frame.
+ */
+
+#ifndef LEDSIM_H_
+#define LEDSIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "ledmatrix.h"
+
+// Command types, in the order they are counted in struct ledsim_counts
+enum ledsim_command {
+	LEDSIM_UPDATE_ALL,
+	LEDSIM_UPDATE_PIXEL,
+	LEDSIM_UPDATE_ROW,
+	LEDSIM_UPDATE_COL,
+	LEDSIM_SHIFT,
+	LEDSIM_CLEAR,
+	LEDSIM_NUM_COMMANDS
+};
+
+struct ledsim_counts {
+	uint32_t bytes;
+	uint32_t commands;
+	uint32_t by_command[LEDSIM_NUM_COMMANDS];
+	uint32_t bad_bytes;		// Bytes that were not part of a valid command
+};
+
+// Clear every panel and all of the counters.
+void ledsim_reset(void);
+
+// Direct the following bytes to the given panel.
+void ledsim_select(uint8_t panel);
+
+// Decode one byte received by the selected panel.
+void ledsim_receive(uint8_t byte);
+
+// Finish the current frame. The counts for the frame are copied to frame
+// (if not NULL) and added to the totals.
+void ledsim_end_frame(struct ledsim_counts* frame);
+
+void ledsim_get_totals(struct ledsim_counts* totals);
+
+// Return the colour shown at (x, y) across all panels.
+PixelColour ledsim_get_pixel(uint8_t x, uint8_t y);
+
+// Return a hash of everything shown on the panels, so that runs can be
+// compared frame by frame.
+uint32_t ledsim_hash(void);
+
+// Draw the panels on an ANSI terminal using 24-bit background colours.
+void ledsim_render_ansi(FILE* out);
+
+// Write the panels to a binary PPM file with each LED drawn as a square of
+// scale by scale pixels. Returns 0 on success, -1 on failure.
+int ledsim_write_ppm(const char* filename, uint8_t scale);
+
+#endif /* LEDSIM_H_ */
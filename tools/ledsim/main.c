@@ -0,0 +1,256 @@
+/*
+ * main.c
+ *
+ * LED matrix emulator. Runs the display code from the game on the host
+ * with the SPI output decoded by a virtual LED matrix (see ledsim.h), and
+ * reports the bytes and commands sent for each frame.
+ *
+ * Usage: ledsim [-s start|marquee|game] [-n frames] [-a] [-p prefix]
+ *               [-x scale] [-q]
+ *   -s  scenario to run (default game)
+ *   -n  number of frames, one every RENDER_PERIOD_MS (default 100)
+ *   -a  draw the display on the terminal after every frame
+ *   -p  write every frame to prefixNNNN.ppm
+ *   -x  size in pixels of each LED in the PPM files (default 8)
+ *   -q  only print the totals
+ *
+ * The per frame lines include a hash of the display contents, so the output
+ * of two builds can be diffed to find the first frame that looks different.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <avr/pgmspace.h>
+#include "ledmatrix.h"
+#include "display.h"
+#include "animation.h"
+#include "marquee.h"
+#include "render.h"
+#include "game.h"
+#include "timer0.h"
+#include "host.h"
+#include "ledsim.h"
+
+enum scenario {
+	SCENARIO_START,
+	SCENARIO_MARQUEE,
+	SCENARIO_GAME
+};
+
+static void start_scenario(enum scenario scenario);
+static void run_frame(enum scenario scenario, uint32_t frame_number);
+static void game_frame(uint32_t frame_number);
+static void print_counts(const struct ledsim_counts* counts);
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-s start|marquee|game] [-n frames] [-a] "
+			"[-p prefix] [-x scale] [-q]\n", name);
+	exit(2);
+}
+
+int main(int argc, char* argv[]) {
+	enum scenario scenario = SCENARIO_GAME;
+	uint32_t num_frames = 100;
+	uint8_t show_ansi = 0;
+	uint8_t quiet = 0;
+	const char* ppm_prefix = NULL;
+	uint8_t scale = 8;
+	int option;
+	
+	while ((option = getopt(argc, argv, "s:n:ap:x:q")) != -1) {
+		switch (option) {
+			case 's':
+				if (!strcmp(optarg, "start")) {
+					scenario = SCENARIO_START;
+				} else if (!strcmp(optarg, "marquee")) {
+					scenario = SCENARIO_MARQUEE;
+				} else if (!strcmp(optarg, "game")) {
+					scenario = SCENARIO_GAME;
+				} else {
+					usage(argv[0]);
+				}
+				break;
+			case 'n':
+				num_frames = strtoul(optarg, NULL, 10);
+				break;
+			case 'a':
+				show_ansi = 1;
+				break;
+			case 'p':
+				ppm_prefix = optarg;
+				break;
+			case 'x':
+				scale = atoi(optarg);
+				if (scale == 0) {
+					usage(argv[0]);
+				}
+				break;
+			case 'q':
+				quiet = 1;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	
+	ledsim_reset();
+	init_timer0();
+	ledmatrix_setup();
+	
+	// Frame 0 is whatever the scenario sends when it starts
+	uint32_t max_bytes = 0;
+	for (uint32_t frame_number = 0; frame_number <= num_frames;
+			frame_number++) {
+		if (frame_number == 0) {
+			start_scenario(scenario);
+		} else {
+			host_advance_time(RENDER_PERIOD_MS);
+			run_frame(scenario, frame_number);
+		}
+		
+		struct ledsim_counts counts;
+		ledsim_end_frame(&counts);
+		if (counts.bytes > max_bytes) {
+			max_bytes = counts.bytes;
+		}
+		if (!quiet) {
+			printf("frame %4u: ", frame_number);
+			print_counts(&counts);
+			printf(" hash %08x\n", ledsim_hash());
+		}
+		if (show_ansi) {
+			ledsim_render_ansi(stdout);
+		}
+		if (ppm_prefix) {
+			char filename[256];
+			snprintf(filename, sizeof(filename), "%s%04u.ppm", ppm_prefix,
+					frame_number);
+			if (ledsim_write_ppm(filename, scale)) {
+				perror(filename);
+				return 1;
+			}
+		}
+	}
+	
+	struct ledsim_counts totals;
+	ledsim_get_totals(&totals);
+	printf("total: ");
+	print_counts(&totals);
+	printf("\nframes %u, average %.1f bytes/frame, max %u bytes/frame, "
+			"final hash %08x\n", num_frames + 1,
+			(double)totals.bytes / (num_frames + 1), max_bytes, ledsim_hash());
+	return totals.bad_bytes ? 1 : 0;
+}
+
+static void start_scenario(enum scenario scenario) {
+	switch (scenario) {
+		case SCENARIO_START:
+			show_start_screen();
+			break;
+		case SCENARIO_MARQUEE:
+			ledmatrix_clear();
+			marquee_start(PSTR("GAME OVER - P1 WINS"), MATRIX_COLOR_SCORE);
+			break;
+		case SCENARIO_GAME:
+			initialise_display();
+			display_compose();
+			ledmatrix_flush();
+			break;
+	}
+}
+
+static void run_frame(enum scenario scenario, uint32_t frame_number) {
+	switch (scenario) {
+		case SCENARIO_START:
+			animation_think();
+			break;
+		case SCENARIO_MARQUEE:
+			marquee_think();
+			break;
+		case SCENARIO_GAME:
+			game_frame(frame_number);
+			display_compose();
+			ledmatrix_flush();
+			break;
+	}
+}
+
+// A scripted rally: the ball bounces around the board every few frames and
+// both paddles follow it. Each return adds to the rally count and every
+// eighth return scores a point.
+#define BALL_STEP_FRAMES 4
+
+static void game_frame(uint32_t frame_number) {
+	static int8_t ball_x = BALL_START_X, ball_y = BALL_START_Y;
+	static int8_t dir_x = RIGHT, dir_y = UP;
+	static uint8_t paddle_y[2] = { BALL_START_Y - 1, BALL_START_Y - 1 };
+	static uint8_t returns, score;
+	
+	if (frame_number == 1) {
+		show_object(ball_x, ball_y, BALL);
+		for (uint8_t player = 0; player < 2; player++) {
+			uint8_t x = player ? PLAYER_2_X : PLAYER_1_X;
+			for (uint8_t i = 0; i < PLAYER_HEIGHT; i++) {
+				show_object(x, paddle_y[player] + i, PLAYER);
+			}
+		}
+		draw_3x3_number(SCORE_1_START_X, SCORE_START_Y, 0);
+		return;
+	}
+	if (frame_number % BALL_STEP_FRAMES) {
+		return;
+	}
+	
+	hide_object(ball_x, ball_y, BALL);
+	if (ball_x + dir_x <= PLAYER_1_X || ball_x + dir_x >= PLAYER_2_X) {
+		dir_x = -dir_x;
+		returns++;
+		draw_rally_count(dir_x == LEFT ? RALLY_2_X : RALLY_1_X,
+				returns % MATRIX_NUM_ROWS);
+		if (returns % 8 == 0) {
+			score = (score + 1) % 10;
+			clear_3x3_grid(SCORE_1_START_X, SCORE_START_Y);
+			draw_3x3_number(SCORE_1_START_X, SCORE_START_Y, score);
+		}
+	}
+	if (ball_y + dir_y < 0 || ball_y + dir_y >= BOARD_HEIGHT) {
+		dir_y = -dir_y;
+	}
+	ball_x += dir_x;
+	ball_y += dir_y;
+	show_object(ball_x, ball_y, BALL);
+	
+	for (uint8_t player = 0; player < 2; player++) {
+		uint8_t x = player ? PLAYER_2_X : PLAYER_1_X;
+		uint8_t target = ball_y > 0 ? ball_y - 1 : 0;
+		if (target > BOARD_HEIGHT - PLAYER_HEIGHT) {
+			target = BOARD_HEIGHT - PLAYER_HEIGHT;
+		}
+		if (target > paddle_y[player]) {
+			hide_object(x, paddle_y[player], PLAYER);
+			paddle_y[player]++;
+			show_object(x, paddle_y[player] + PLAYER_HEIGHT - 1, PLAYER);
+		} else if (target < paddle_y[player]) {
+			hide_object(x, paddle_y[player] + PLAYER_HEIGHT - 1, PLAYER);
+			paddle_y[player]--;
+			show_object(x, paddle_y[player], PLAYER);
+		}
+	}
+}
+
+static void print_counts(const struct ledsim_counts* counts) {
+	printf("%5u bytes %3u commands (all %u pixel %u row %u col %u "
+			"shift %u clear %u)", counts->bytes, counts->commands,
+			counts->by_command[LEDSIM_UPDATE_ALL],
+			counts->by_command[LEDSIM_UPDATE_PIXEL],
+			counts->by_command[LEDSIM_UPDATE_ROW],
+			counts->by_command[LEDSIM_UPDATE_COL],
+			counts->by_command[LEDSIM_SHIFT],
+			counts->by_command[LEDSIM_CLEAR]);
+	if (counts->bad_bytes) {
+		printf(" BAD %u", counts->bad_bytes);
+	}
+}
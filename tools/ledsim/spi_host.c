@@ -0,0 +1,48 @@
+/*
+ * spi_host.c
+ *
+ * Host version of spi.c. Every byte sent goes straight to the LED matrix
+ * emulator, so the queue is always empty.
+ */
+
+#include "spi.h"
+#include "ledsim.h"
+
+void spi_setup_master(uint8_t clockdivider) {
+	(void)clockdivider;
+	ledsim_select(0);
+}
+
+void spi_set_clock_divider(uint8_t clockdivider) {
+	(void)clockdivider;
+}
+
+uint8_t spi_send_byte(uint8_t byte) {
+	ledsim_receive(byte);
+	return 0;
+}
+
+void spi_enqueue(uint8_t byte) {
+	ledsim_receive(byte);
+}
+
+void spi_setup_slaves(uint8_t num_slaves) {
+	(void)num_slaves;
+	ledsim_select(0);
+}
+
+void spi_enqueue_select(uint8_t slave) {
+	ledsim_select(slave);
+}
+
+// Pauses only affect timing, which the emulator doesn't model
+void spi_enqueue_pause(uint8_t fine_ticks) {
+	(void)fine_ticks;
+}
+
+void spi_flush(void) {
+}
+
+uint8_t spi_tx_high_water_mark(void) {
+	return 0;
+}
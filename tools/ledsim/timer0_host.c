@@ -0,0 +1,48 @@
+/*
+ * timer0_host.c
+ *
+ * Host version of timer0.c. Time only moves when host_advance_time() is
+ * called, so runs are repeatable.
+ */
+
+#include "timer0.h"
+#include "host.h"
+
+static uint32_t clock_ticks_ms;
+static uint8_t render_period;
+static uint8_t render_countdown;
+static uint8_t render_tick;
+
+void init_timer0(void) {
+	clock_ticks_ms = 0;
+}
+
+uint32_t get_current_time(void) {
+	return clock_ticks_ms;
+}
+
+uint16_t get_fine_time(void) {
+	return (uint16_t)(clock_ticks_ms * FINE_TICKS_PER_MS);
+}
+
+void set_render_period(uint8_t period_ms) {
+	render_period = period_ms;
+	render_countdown = period_ms;
+	render_tick = 0;
+}
+
+uint8_t render_tick_occurred(void) {
+	uint8_t tick = render_tick;
+	render_tick = 0;
+	return tick;
+}
+
+void host_advance_time(uint32_t ms) {
+	while (ms--) {
+		clock_ticks_ms++;
+		if (render_period && --render_countdown == 0) {
+			render_countdown = render_period;
+			render_tick = 1;
+		}
+	}
+}
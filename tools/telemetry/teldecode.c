@@ -0,0 +1,227 @@
+/*
+ * teldecode.c
+ *
+ * Decodes the telemetry stream from the game (see telemetry.h). The game
+ * state frames are written as CSV and the trace records (see trace.h) as
+ * lines of text. Anything between frames, such as terminal output, fails
+ * the CRC check and is skipped.
+ *
+ * Usage: teldecode [-l trace_file] [capture]
+ *   Reads the capture file (or standard input if none is given), writes
+ *   CSV to standard output, the trace to trace_file (or standard error)
+ *   and a summary to standard error.
+ *
+ * For example, to record straight from the serial port:
+ *   stty -F /dev/ttyUSB0 19200 raw && ./teldecode /dev/ttyUSB0
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "telemetry.h"
+#include "trace.h"
+
+// Longest run of bytes between zeros we try to decode. Terminal output
+// can be much longer, but it isn't a frame anyway.
+#define MAX_SEGMENT		(TELEMETRY_MAX_PAYLOAD + TELEMETRY_OVERHEAD)
+
+// Trace message formats, by number
+static const char* const TRACE_FORMATS[TRACE_NUM_MESSAGES] = {
+#define TRACE_MESSAGE(id, format, text) format,
+	TRACE_MESSAGES
+#undef TRACE_MESSAGE
+};
+
+static FILE* trace_output;
+
+struct counts {
+	unsigned long frames;
+	unsigned long trace_records;
+	unsigned long rejected;	// failed the COBS, CRC or length checks,
+							// including any terminal text
+	unsigned long skipped;	// too long to be a frame
+	unsigned long lost;		// gaps in the sequence numbers
+};
+
+// Same as _crc_ccitt_update() in avr-libc
+static uint16_t crc_ccitt_update(uint16_t crc, uint8_t data) {
+	crc ^= data;
+	for (int i = 0; i < 8; i++) {
+		crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+	}
+	return crc;
+}
+
+// Undo the COBS encoding of a segment. Returns the decoded length, or -1 if
+// the segment isn't valid COBS.
+static int cobs_decode(const uint8_t* in, int length, uint8_t* out) {
+	int out_length = 0;
+	int i = 0;
+	while (i < length) {
+		uint8_t code = in[i++];
+		if (code == 0 || i + code - 1 > length) {
+			return -1;
+		}
+		for (int j = 1; j < code; j++) {
+			out[out_length++] = in[i++];
+		}
+		if (i < length) {
+			out[out_length++] = 0;
+		}
+	}
+	return out_length;
+}
+
+static void write_state(const uint8_t* payload, struct counts* counts) {
+	static int last_sequence = -1;
+	uint8_t sequence = payload[STATE_SEQUENCE];
+	if (last_sequence >= 0) {
+		counts->lost += (uint8_t)(sequence - last_sequence - 1);
+	}
+	last_sequence = sequence;
+	
+	uint32_t time = 0;
+	for (int i = 3; i >= 0; i--) {
+		time = (time << 8) | payload[STATE_TIME + i];
+	}
+	printf("%lu,%u,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", (unsigned long)time,
+			sequence, (int8_t)payload[STATE_BALL_X],
+			(int8_t)payload[STATE_BALL_Y],
+			(int8_t)payload[STATE_BALL_X_DIRECTION],
+			(int8_t)payload[STATE_BALL_Y_DIRECTION],
+			(int8_t)payload[STATE_PADDLE_1_Y],
+			(int8_t)payload[STATE_PADDLE_2_Y],
+			(int8_t)payload[STATE_SCORE_1], (int8_t)payload[STATE_SCORE_2],
+			(int8_t)payload[STATE_RALLY_1], (int8_t)payload[STATE_RALLY_2]);
+}
+
+// Write out each record in a trace frame. Returns 0 if the records don't
+// fill the payload exactly.
+static int write_trace(const uint8_t* payload, int length,
+		struct counts* counts) {
+	// The records only carry the low 16 bits of the time, so count the
+	// times they wrap (this assumes no gaps of over a minute)
+	static uint32_t time;
+	int i = 0;
+	while (i + 4 <= length) {
+		uint8_t id = payload[i];
+		uint8_t num_args = payload[i + 1];
+		uint16_t low_time = payload[i + 2] | (payload[i + 3] << 8);
+		i += 4;
+		if (num_args > TRACE_MAX_ARGS || i + 2 * num_args > length) {
+			return 0;
+		}
+		int args[TRACE_MAX_ARGS] = {0};
+		for (int j = 0; j < num_args; j++) {
+			args[j] = (int16_t)(payload[i] | (payload[i + 1] << 8));
+			i += 2;
+		}
+		if (low_time < (uint16_t)time) {
+			time += 0x10000;
+		}
+		time = (time & 0xFFFF0000) | low_time;
+		
+		fprintf(trace_output, "%10lu ", (unsigned long)time);
+		if (id < TRACE_NUM_MESSAGES) {
+			fprintf(trace_output, TRACE_FORMATS[id], args[0], args[1],
+					args[2], args[3]);
+		} else {
+			fprintf(trace_output, "unknown message %u: %d %d %d %d", id,
+					args[0], args[1], args[2], args[3]);
+		}
+		fputc('\n', trace_output);
+		counts->trace_records++;
+	}
+	return i == length;
+}
+
+static void decode_segment(const uint8_t* segment, int length,
+		struct counts* counts) {
+	uint8_t frame[MAX_SEGMENT];
+	int frame_length = cobs_decode(segment, length, frame);
+	if (frame_length < 3) {
+		counts->rejected++;
+		return;
+	}
+	uint16_t crc = 0xFFFF;
+	for (int i = 0; i < frame_length - 2; i++) {
+		crc = crc_ccitt_update(crc, frame[i]);
+	}
+	if (frame[frame_length - 2] != (crc & 0xFF) ||
+			frame[frame_length - 1] != (crc >> 8)) {
+		counts->rejected++;
+		return;
+	}
+	
+	uint8_t type = frame[0];
+	int payload_length = frame_length - 3;
+	if (type == TELEMETRY_STATE && payload_length == STATE_LENGTH) {
+		write_state(&frame[1], counts);
+		counts->frames++;
+	} else if (type == TELEMETRY_TRACE &&
+			write_trace(&frame[1], payload_length, counts)) {
+		counts->frames++;
+	} else {
+		counts->rejected++;
+	}
+}
+
+int main(int argc, char** argv) {
+	FILE* input = stdin;
+	trace_output = stderr;
+	int option;
+	while ((option = getopt(argc, argv, "l:")) != -1) {
+		if (option == 'l') {
+			if (!(trace_output = fopen(optarg, "w"))) {
+				perror(optarg);
+				return 1;
+			}
+		} else {
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind < argc - 1 || optind > argc) {
+		fprintf(stderr, "Usage: %s [-l trace_file] [capture]\n", argv[0]);
+		return 1;
+	}
+	if (optind == argc - 1 && !(input = fopen(argv[optind], "rb"))) {
+		perror(argv[optind]);
+		return 1;
+	}
+	
+	printf("time_ms,sequence,ball_x,ball_y,ball_x_direction,"
+			"ball_y_direction,paddle_1_y,paddle_2_y,score_1,score_2,"
+			"rally_1,rally_2\n");
+	
+	// Collect the bytes between zeros. Empty segments are the zeros at
+	// each end of a frame meeting.
+	struct counts counts = {0};
+	uint8_t segment[MAX_SEGMENT];
+	int length = 0;
+	int too_long = 0;
+	int c;
+	while ((c = fgetc(input)) != EOF) {
+		if (c) {
+			if (length < MAX_SEGMENT) {
+				segment[length++] = c;
+			} else {
+				too_long = 1;
+			}
+			continue;
+		}
+		if (too_long) {
+			counts.skipped++;
+		} else if (length) {
+			decode_segment(segment, length, &counts);
+		}
+		length = 0;
+		too_long = 0;
+	}
+	
+	fprintf(stderr, "%lu frames (%lu trace records), %lu rejected, "
+			"%lu skipped, %lu lost\n", counts.frames, counts.trace_records,
+			counts.rejected, counts.skipped, counts.lost);
+	return 0;
+}
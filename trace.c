@@ -0,0 +1,95 @@
+/*
+ * trace.c
+ *
+ * Trace log recorded to RAM and formatted on the host.
+ */
+
+#include "trace.h"
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "telemetry.h"
+#include "timer0.h"
+
+#define TRACE_RING_MASK		(TRACE_RING_SIZE - 1)
+
+// Records are added at the head (by anything, including interrupt handlers,
+// so with interrupts off), sent from the tail by trace_think() only and
+// read from pane_tail by trace_read_event() only.
+static struct trace_record ring[TRACE_RING_SIZE];
+static volatile uint8_t head;
+static volatile uint8_t tail;
+static volatile uint8_t pane_tail;
+static struct trace_stats stats;
+
+void trace_event(uint8_t id, uint8_t num_args, int16_t arg0, int16_t arg1,
+		int16_t arg2, int16_t arg3) {
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	uint8_t next = (head + 1) & TRACE_RING_MASK;
+	if (next == tail || next == pane_tail) {
+		stats.dropped++;
+	} else {
+		struct trace_record* record = &ring[head];
+		record->id = id;
+		record->num_args = num_args;
+		record->time = get_current_time();
+		record->args[0] = arg0;
+		record->args[1] = arg1;
+		record->args[2] = arg2;
+		record->args[3] = arg3;
+		head = next;
+	}
+	if (interrupts_enabled) {
+		sei();
+	}
+}
+
+void trace_think(void) {
+	if (!telemetry_is_enabled()) {
+		tail = head;
+		return;
+	}
+	while (tail != head) {
+		// Pack as many records as fit into one frame: id, number of
+		// arguments, time and arguments, all low byte first
+		uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+		uint8_t length = 0;
+		uint8_t next_tail = tail;
+		while (next_tail != head) {
+			struct trace_record* record = &ring[next_tail];
+			uint8_t record_length = 4 + 2 * record->num_args;
+			if (length + record_length > TELEMETRY_MAX_PAYLOAD) {
+				break;
+			}
+			payload[length++] = record->id;
+			payload[length++] = record->num_args;
+			payload[length++] = record->time;
+			payload[length++] = record->time >> 8;
+			for (uint8_t i = 0; i < record->num_args; i++) {
+				payload[length++] = record->args[i];
+				payload[length++] = record->args[i] >> 8;
+			}
+			next_tail = (next_tail + 1) & TRACE_RING_MASK;
+		}
+		if (!telemetry_send_frame(TELEMETRY_TRACE, payload, length)) {
+			// Try again once the serial port has caught up
+			return;
+		}
+		stats.sent += (uint8_t)(next_tail - tail) & TRACE_RING_MASK;
+		tail = next_tail;
+	}
+}
+
+uint8_t trace_read_event(struct trace_record* record) {
+	if (pane_tail == head) {
+		return 0;
+	}
+	*record = ring[pane_tail];
+	pane_tail = (pane_tail + 1) & TRACE_RING_MASK;
+	return 1;
+}
+
+void trace_get_stats(struct trace_stats* stats_out) {
+	*stats_out = stats;
+}
@@ -0,0 +1,85 @@
+/*
+ * trace.h
+ *
+ * Trace log that is cheap enough to leave turned on. Each call records a
+ * message number, the time and up to four numbers in a RAM ring - no
+ * formatting happens on the AVR. trace_think() sends the records as
+ * telemetry frames (see telemetry.h) and the host decoder
+ * (tools/telemetry) puts them into the message text. A record is at most
+ * 12 bytes on the wire where the printf_P() it replaces would send 30 or
+ * more, and takes a few dozen cycles instead of thousands.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+// The messages, in printf() format with an int for each argument, and the
+// text shown for them in the event log pane (see eventlog.h) with each %
+// replaced by the next argument, or "" for messages the pane leaves out.
+// The host decoder is built from this list too, so new messages go on the
+// end to keep old captures readable.
+#define TRACE_MESSAGES \
+	TRACE_MESSAGE(TRACE_GAME_START,	"game start, ball moves every %d ms", \
+			"New game, ball moves every % ms") \
+	TRACE_MESSAGE(TRACE_GAME_OVER,	"game over, player %d wins", \
+			"Game over, player % wins") \
+	TRACE_MESSAGE(TRACE_HIT,		"player %d hit, rally %d", "") \
+	TRACE_MESSAGE(TRACE_POINT,		"point to player %d, score %d-%d, %d hits", \
+			"Point to player %, %-%, rally of % hits") \
+	TRACE_MESSAGE(TRACE_PAUSE,		"paused", "Paused") \
+	TRACE_MESSAGE(TRACE_ADC,		"adc %d, mapped %d", "") \
+	TRACE_MESSAGE(TRACE_BAUD,		"baud rate %d00", "") \
+	TRACE_MESSAGE(TRACE_SPEED,		"ball moves every %d ms", \
+			"Ball speed now % ms") \
+	TRACE_MESSAGE(TRACE_RESUME,		"resumed", "Resumed")
+
+enum trace_message {
+#define TRACE_MESSAGE(id, format, text) id,
+	TRACE_MESSAGES
+#undef TRACE_MESSAGE
+	TRACE_NUM_MESSAGES
+};
+
+// Records that can be waiting to be sent (a power of two)
+#define TRACE_RING_SIZE		(8)
+#define TRACE_MAX_ARGS		(4)
+
+// Record a message with num_args arguments. Can be called from interrupt
+// handlers. If the ring is full the record is dropped and counted. Use the
+// macros below rather than calling this directly.
+void trace_event(uint8_t id, uint8_t num_args, int16_t arg0, int16_t arg1,
+		int16_t arg2, int16_t arg3);
+
+#define TRACE0(id)				trace_event((id), 0, 0, 0, 0, 0)
+#define TRACE1(id, a)			trace_event((id), 1, (a), 0, 0, 0)
+#define TRACE2(id, a, b)		trace_event((id), 2, (a), (b), 0, 0)
+#define TRACE3(id, a, b, c)		trace_event((id), 3, (a), (b), (c), 0)
+#define TRACE4(id, a, b, c, d)	trace_event((id), 4, (a), (b), (c), (d))
+
+struct trace_record {
+	uint8_t id;
+	uint8_t num_args;
+	uint16_t time;		// low 16 bits of the time in ms
+	int16_t args[TRACE_MAX_ARGS];
+};
+
+// Send waiting records, as many as fit in the serial output buffer. While
+// telemetry is off they are thrown away.
+void trace_think(void);
+
+// The event log pane reads the records as well, separately from
+// trace_think(), and a record isn't overwritten until both have had it.
+// Copies the oldest record the pane hasn't read to record and returns 1,
+// or returns 0 if there are none.
+uint8_t trace_read_event(struct trace_record* record);
+
+struct trace_stats {
+	uint16_t sent;
+	uint16_t dropped;	// ring full
+};
+
+void trace_get_stats(struct trace_stats* stats);
+
+#endif /* TRACE_H_ */